@@ -0,0 +1,100 @@
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+enum IOOp {IO_READ, IO_WRITE, IO_FSYNC};
+
+typedef struct IORequest {
+    int fd;                         // file to read from, write to, or flush to storage
+    uint8_t *buffer;                // data (must stay valid until the request completes)
+    size_t length;                  // number of bytes
+    int64_t offset;                 // file offset
+    IOOp op;                        // read into `buffer`, write `buffer`, or fdatasync the file
+    void *user;                     // returned with the completion
+} IORequest;
+
+typedef struct IOCompletion {
+    void *user;                     // `user` of the completed request
+    int64_t result;                 // bytes transferred (may be short), or -errno
+} IOCompletion;
+
+// Asynchronous positioned reads and writes (and data syncs), submitted in batches. `create` picks Linux io_uring
+// when available, and otherwise a pool of threads doing pread/pwrite
+class AsyncIO {
+public:
+    virtual ~AsyncIO() {}
+
+    virtual const char* name() = 0;
+    virtual void submit(const std::vector<IORequest>& requests) = 0;
+    virtual void wait(std::vector<IOCompletion>& completions, size_t min_count) = 0;
+
+    static AsyncIO* create(std::string backend, int num_threads);
+};
+
+// io_uring through raw system calls (no liburing), with the submission and completion rings mapped
+// into the process. Requests beyond the ring's capacity wait in a backlog
+class UringIO : public AsyncIO {
+private:
+    int _ring_fd;
+    unsigned int _entries;
+    void *_sq_ptr;
+    size_t _sq_size;
+    void *_cq_ptr;
+    size_t _cq_size;
+    void *_sqes;
+    size_t _sqes_size;
+    unsigned int *_sq_head;
+    unsigned int *_sq_tail;
+    unsigned int *_sq_mask;
+    unsigned int *_sq_array;
+    unsigned int *_cq_head;
+    unsigned int *_cq_tail;
+    unsigned int *_cq_mask;
+    void *_cqes;
+    size_t _in_flight;
+    std::deque<IORequest> _backlog;
+
+    unsigned int queueRequests();
+    void enter(unsigned int to_submit, unsigned int min_complete);
+
+public:
+    UringIO();
+    ~UringIO();
+
+    bool init(unsigned int entries);
+    const char* name();
+    void submit(const std::vector<IORequest>& requests);
+    void wait(std::vector<IOCompletion>& completions, size_t min_count);
+};
+
+// Fallback for kernels (or sandboxes) without io_uring
+class ThreadPoolIO : public AsyncIO {
+private:
+    std::mutex _mutex;
+    std::condition_variable _request_cv;
+    std::condition_variable _complete_cv;
+    std::vector<std::thread> _threads;
+    std::deque<IORequest> _requests;
+    std::deque<IOCompletion> _completions;
+    bool _stop;
+
+    void run();
+
+public:
+    ThreadPoolIO(int num_threads);
+    ~ThreadPoolIO();
+
+    const char* name();
+    void submit(const std::vector<IORequest>& requests);
+    void wait(std::vector<IOCompletion>& completions, size_t min_count);
+};
+
+#endif // ASYNCIO_H
@@ -3,40 +3,205 @@
 
 #include <string>
 #include <map>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <stdexcept>
 #include <sys/stat.h>
 #include "glslloader.h"
+#include "frameindex.h"
+#include "framemanifest.h"
+#include "prefetcher.h"
+#include "outputwriter.h"
+#include "framesource.h"
+#include "rendercache.h"
+
+typedef struct C2EOptions {
+    std::string layout;             // input frames as six face files ('faces'), or one packed image
+                                    // per frame ('cross', '3x2', or '6x1')
+    std::string pipeline;           // 'fragment' (full-screen quad), 'compute' (GL 4.3 compute shader),
+                                    // 'remap' (precomputed mapping), or 'mesh' (tessellated faces)
+    int mesh_density;               // grid cells along each cube face edge for the mesh pipeline
+    int workgroup_size[2];          // compute shader workgroup size
+    bool scaled_decode;             // decode faces at reduced resolution when larger than the output needs
+    bool mipmaps;                   // build a mip chain for each face to filter minified regions
+    int antialias;                  // max samples per axis taken where the mapping minifies or crosses a face edge
+    bool stats;                     // wait for the GPU after each stage so it can be timed accurately
+    int frame_start;                // first frame number to convert
+    int frame_end;                  // last frame number to convert (-1 for no limit)
+    int frame_stride;               // convert every Nth frame number, counting from `frame_start`
+    int shard_index;                // which block of the selected frames to convert (0-based)...
+    int shard_count;                // ...out of this many contiguous, balanced blocks
+    bool resume;                    // skip frames whose recorded outputs are up to date
+    bool cache;                     // hash face contents to reuse outputs of identical frames and
+                                    // re-render only the faces that changed
+    bool dirty;                     // update the previous frame's output where refreshed faces feed it
+    int prefetch_frames;            // number of upcoming frames to read ahead (0 to read on demand)
+    std::string io_backend;         // read-ahead I/O ('auto', 'uring', or 'threads')
+    int io_threads;                 // number of threads reading ahead (for the 'threads' backend)
+    int64_t prefetch_budget;        // max bytes held by read-ahead
+    int64_t write_budget;           // max bytes of encoded output waiting to be written (0 to write synchronously)
+    int sync_batch;                 // flush outputs to storage in batches of this many files (0 to leave it to the OS)
+    std::string decoder;            // command that decodes video input (ffmpeg, or one taking the same arguments)
+    int raw_face_size[2];           // width and height of raw faces read from stdin (0 to read them from the stream's header)
+    int output_fd;                  // file descriptor that frames are streamed to when the output is '-'
+    int framerate;                  // frames per second declared in a Y4M output stream
+    int ring_slots;                 // frames held by a shared memory output ring
+    bool watch;                     // keep converting frames as they are written to the input directory...
+    int watch_idle_ms;              // ...until no files arrive for this long (0 for no limit)...
+    std::string watch_sentinel;     // ...or a file of this name appears in it
+    double deadline_ms;             // real-time mode: target latency per frame, dropping or degrading frames when behind (0 for off)
+    int psnr_interval;              // measure PSNR against a supersampled reference on every Nth rendered frame (0 for never)
+} C2EOptions;
+
+typedef struct C2EFrameStats {
+    int frame;                      // frame number
+    double decode_ms;               // time spent decoding face images
+    double upload_ms;               // time spent uploading faces to textures (and building mip chains)
+    double convert_ms;              // time spent rendering the equirectangular projection
+    double readback_ms;             // time spent reading the equirectangular image back from the GPU
+    double encode_ms;               // time spent encoding the output image (and waiting for room to queue it)
+    int64_t samples;                // number of face samples taken to render the frame
+    bool skipped;                   // output was already up to date (or reused), so nothing was rendered
+    int reused_from;                // frame whose output was reused (-1 if none)
+    int faces_rendered;             // number of faces whose output pixels were rendered
+    int faces_refreshed;            // number of faces decoded and uploaded (the others were unchanged)
+    int dirty_regions;              // number of regions of the previous output updated (-1 if rendered in full)
+    double latency_ms;              // time from the input frame being made (or read) to its output being queued or published
+    int degrade_level;              // real-time mode: 0 rendered in full, 1 with cheaper filtering, 2 also at half resolution
+    int dropped_frames;             // real-time mode: late frames dropped just before this one
+    double psnr_db;                 // PSNR against a supersampled CPU reference of the frame (0 if not measured)
+} C2EFrameStats;
+
+// Thrown when a conversion cannot go on (e.g. an unreadable image, or an output that could not be
+// written); the message says why
+class C2EError : public std::runtime_error {
+public:
+    explicit C2EError(const std::string& message) : std::runtime_error(message) {}
+};
 
 class Cube2Equirect {
 private:
+    // A frame to record in the frame manifest once its output is written
+    typedef struct PendingRecord {
+        int64_t write_sequence;
+        FrameEntry frame;
+        std::string output_name;
+        uint64_t face_hash[6];
+    } PendingRecord;
+
     std::string _input_dir;
-    std::string _input_format;
     std::string _output_dir;
     std::string _output_format;
     int _output_width;
     int _output_height;
     uint8_t *_output_pixels;
-    int _frame_count;
-    char _frame_idx[7];
+    C2EOptions _options;
+    CubeLayout _layout;
+    int _face_resolution;
+    FrameIndex _frames;
+    size_t _range_frame_count;
+    size_t _next_frame;
+    std::vector<std::string> _output_files;
+    FrameManifest _manifest;
+    uint64_t _params_hash;
     GLuint _program;
     GLint _vertex_position_attrib;
     GLint _vertex_texcoord_attrib;
     std::map<std::string,GLint> _uniforms;
     GLuint _vertex_array;
+    GLuint _output_buffer;
+    GLint _mesh_first[6];
+    GLsizei _mesh_count[6];
     GLuint _cube_textures[6];
+    GLuint _cube_array;
+    GLuint _remap_texture;
+    int _face_sizes[6];
+    int64_t _sample_count;
+    C2EFrameStats _frame_stats;
+    FaceArchive _archive;
+    std::vector<uint8_t> _face_data[6];
+    const uint8_t *_face_bytes[6];
+    size_t _face_lengths[6];
+    FaceFile _loaded_faces[6];
+    uint64_t _loaded_face_hashes[6];
+    GLuint _previous_texture;
+    GLuint _previous_framebuffer;
+    bool _output_valid;
+    int _face_regions[6][4];
+    Prefetcher _prefetcher;
+    size_t _prefetched_until;
+    OutputWriter _writer;
+    std::vector<uint8_t> _encoded;
+    std::deque<PendingRecord> _pending_records;
+    FrameSource *_source;
+    const SourceFrame *_source_frame;
+    double _source_wait_ms;
+    ShmRing *_output_ring;
+    int64_t _frame_timestamp_ns;
+    int _degrade_level;
+    int _max_degrade_level;
+    int _on_time_frames;
+    int _dropped_frames;
+    int64_t _rendered_frames;
+    GLuint _upscale_texture;
+    GLuint _upscale_framebuffer;
+    RenderCache *_cache;
+    bool _owns_cache;
     
+    void setup(std::string in_dir, std::string out_dir, std::string out_format, int out_w, int out_h, C2EOptions options, RenderCache *cache);
+    void release();
+    [[noreturn]] void fail(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void renderFrame(const FrameEntry& frame);
+    void renderSourceFrame(const SourceFrame& frame);
+    int64_t convertFrame(int face_mask, int refreshed_mask, bool output_valid, std::string output_path);
+    void prefetchFrames();
+    void renderRegion(const int rect[4], int face_mask, bool clear);
+    void renderReducedFrame();
+    void readRegion(const int rect[4]);
+    double measureQuality();
+    bool isFrameUpToDate(const FrameEntry& frame, std::string output_name);
+    bool isOutputValid(const FrameRecord& record);
+    bool reuseOutput(const FrameRecord& record, std::string output_path);
+    int preparePartialFrame(const FrameEntry& frame, std::string output_name, const uint64_t face_hash[6]);
+    void recordFrame(const FrameEntry& frame, std::string output_name, const uint64_t face_hash[6]);
+    void recordWrittenFrames(bool wait);
+    void finishOutput();
+    void updateDegradeLevel(double latency_ms);
+    void setDegradeLevel(int level);
+    uint64_t hashConversionParameters();
+    std::string makeOutputName(const FrameEntry& frame);
+    bool isSameFile(const FaceFile& a, const FaceFile& b);
+    bool readFile(std::string filename, std::vector<uint8_t>& data);
     std::string makePath(std::string path);
+    std::string makeShmName(std::string name);
+    double elapsedMs(std::chrono::steady_clock::time_point start);
+    int64_t timestampNs();
+    GLint uniformLocation(const char *name);
     void init();
-    void createVertexArrayObject();
+    void createVertexArrayObject(RenderCache::Geometry *geometry);
+    void createFaceMeshVertexArrayObject(RenderCache::Geometry *geometry);
     void createCubemapTextures();
-    void updateTextureFromImage(std::string filename, GLuint texture);
+    void createRemapTexture();
+    void updateTextureFromImage(std::string filename, int face);
+    void updateTexturesFromPackedImage(std::string filename, int face_mask);
+    uint8_t* decodeImage(std::string filename, const uint8_t *data, size_t size, int min_size, int *width, int *height);
+    void uploadFace(std::string filename, int face, uint8_t *pixels, int width, int height);
 
 public:
-    Cube2Equirect(std::string in_dir, std::string out_dir, std::string out_format, int out_w, int out_h);
+    Cube2Equirect(std::string in_dir, std::string out_dir, std::string out_format, int out_w, int out_h, C2EOptions options, RenderCache *cache = NULL);
     ~Cube2Equirect();
     
     bool hasMoreFrames();
     void renderNextFrame();
     std::string getEquirectImageFormat();
+    size_t getRangeFrameCount();
+    const std::vector<std::string>& getOutputFiles();
+    const C2EFrameStats& getFrameStats();
+    PrefetchStats getPrefetchStats();
+    const char* getPrefetchBackend();
+    WriterStats getWriterStats();
+    const char* getWriterBackend();
 
     /*
     void initGL(std::string inDir, std::string outDir, int outRes, std::string outFmt);
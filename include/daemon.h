@@ -0,0 +1,14 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <string>
+#include "cube2equirect.h"
+#include "jobrunner.h"
+
+// Job protocol on the Unix domain socket: the client sends one line of tab-separated 'key=value'
+// fields ('input', 'output', 'width', 'format', and optionally 'client'), and the daemon replies with
+// one line once the job has finished: 'ok frames=N ms=T worker=W warm=0|1', or 'error MESSAGE'
+int runDaemon(std::string socket_path, int num_workers, C2EOptions options);
+int submitJob(std::string socket_path, const ConversionJob& job);
+
+#endif // DAEMON_H
@@ -0,0 +1,25 @@
+#ifndef EQMAP_H
+#define EQMAP_H
+
+#include <cstdint>
+#include <vector>
+
+// CPU implementation of the equirectangular to cube face mapping used by the shaders
+namespace eqmap {
+    typedef struct FaceCoord {
+        int face;                       // 0: left, 1: right, 2: bottom, 3: top, 4: back, 5: front
+        double px[2];                   // face coordinate in [0, 1]
+        double dpx_dx[2];               // change in face coordinate across one output pixel horizontally
+        double dpx_dy[2];               // change in face coordinate across one output pixel vertically
+    } FaceCoord;
+
+    void mapToCube(double theta, double phi, const double pixel_angle[2], FaceCoord *fc);
+    void mapPixel(int x, int y, int width, int height, FaceCoord *fc);
+    int adaptiveSamples(const FaceCoord& fc, int face_size, int max_samples);
+    int64_t countAdaptiveSamples(int width, int height, const int face_sizes[6], int max_samples);
+    void faceCoverage(int width, int height, int rects[6][4]);
+    void buildFaceMesh(int face, int density, std::vector<float>& positions, std::vector<float>& texcoords);
+    double supersampledPsnr(const uint8_t *image, int width, int height, const uint8_t *const faces[6], const int face_sizes[6], int step, int supersample);
+}
+
+#endif // EQMAP_H
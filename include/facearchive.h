@@ -0,0 +1,48 @@
+#ifndef FACEARCHIVE_H
+#define FACEARCHIVE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+typedef struct ArchiveMember {
+    std::string name;               // member path within the archive
+    int64_t offset;                 // offset of the member's data in the archive
+    int64_t stored_size;            // bytes of data in the archive
+    int64_t size;                   // bytes once extracted
+    int method;                     // 0 (stored) or 8 (deflated)
+    int64_t mtime_ns;               // modification time (nanoseconds since the epoch)
+    int64_t data_member;            // member whose data this is (differs for tar hard links)
+} ArchiveMember;
+
+// Uncompressed tar, or zip (stored or deflated members, including zip64) mapped into memory, with an
+// index of its regular file members built once when opened. Stored members are read in place
+class FaceArchive {
+private:
+    int _fd;
+    const uint8_t *_data;
+    size_t _size;
+    int64_t _device;
+    int64_t _inode;
+    std::vector<ArchiveMember> _members;
+
+    bool indexTar();
+    bool indexZip();
+    bool applyExtraFields(const uint8_t *extra, size_t extra_length, ArchiveMember *member, int64_t *local_offset);
+
+public:
+    FaceArchive();
+    ~FaceArchive();
+
+    bool open(std::string path);
+    bool isOpen();
+    size_t size();
+    const ArchiveMember& at(size_t idx);
+    int64_t getDevice();
+    int64_t getInode();
+    bool read(size_t idx, std::vector<uint8_t>& buffer, const uint8_t **data, size_t *size);
+    void willNeed(size_t idx);
+};
+
+#endif // FACEARCHIVE_H
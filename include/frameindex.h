@@ -0,0 +1,74 @@
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstdint>
+#include "facearchive.h"
+
+typedef struct FaceFile {
+    std::string path;               // full path of the face image ('<archive>:<member>' in an archive)
+    std::string format;             // 'jpg' or 'png'
+    int64_t size;                   // file size in bytes
+    int64_t mtime_ns;               // modification time (nanoseconds since the epoch)
+    int64_t device;                 // device and inode, which identify hard links to the same file
+    int64_t inode;
+    int64_t member;                 // archive member holding the data (-1 for a plain file)
+} FaceFile;
+
+// Where each face sits in a packed frame image, in face-sized cells (no cells for six face files)
+typedef struct CubeLayout {
+    std::string name;               // 'faces', 'cross', '3x2', or '6x1'
+    int columns;                    // cells across the packed image (0 for six face files)
+    int rows;                       // cells down the packed image
+    int cells[6][2];                // column and row (from the top) of each face
+} CubeLayout;
+
+typedef struct FrameEntry {
+    int number;                     // frame number from the file names (NNNNNN_<face>.<ext>)
+    FaceFile faces[6];              // left, right, bottom, top, back, front (the same file, if packed)
+} FrameEntry;
+
+// Sorted index of the cubemap frames in a directory (or archive), built with a single pass over its
+// entries. Frames may start at any number, have gaps, and mix image formats. A watched directory's
+// index grows as more frames are written to it
+class FrameIndex {
+private:
+    std::vector<FrameEntry> _frames;
+    bool _packed;
+    int _start;
+    int _end;
+    int _stride;
+    int _watch_fd;
+    int _watch_dir_fd;
+    std::string _watch_dir;
+    std::map<int, FrameEntry> _partial;
+    std::set<int> _indexed;
+
+    bool parseFaceName(const char *name, int *number, int *face, std::string *format);
+    bool readFace(int dir_fd, std::string dir, const char *name, int *number, int *face, FaceFile *file);
+    void addFace(std::map<int, FrameEntry>& frames, int number, int face, const FaceFile& file);
+    void keepCompleteFrames(std::map<int, FrameEntry>& frames);
+    void readWatchEvents();
+    void rescanWatchedDirectory();
+    void dropPartialFrames();
+
+public:
+    static const char *FACE_NAMES[6];
+    static bool findLayout(std::string name, CubeLayout *layout);
+
+    FrameIndex();
+    ~FrameIndex();
+
+    bool scan(std::string dir, bool packed);
+    void scanArchive(FaceArchive& archive, std::string archive_path, bool packed);
+    bool watch(std::string dir, bool packed);
+    bool waitForFrames(int idle_ms, std::string sentinel);
+    size_t select(int start, int end, int stride, int shard_index, int shard_count);
+    size_t size();
+    const FrameEntry& at(size_t idx);
+};
+
+#endif // FRAMEINDEX_H
@@ -0,0 +1,44 @@
+#ifndef FRAMEMANIFEST_H
+#define FRAMEMANIFEST_H
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+typedef struct FrameRecord {
+    int number;                     // source frame number
+    uint64_t params_hash;           // hash of the conversion parameters the output was made with
+    std::string output;             // output image file name (relative to the output directory)
+    int64_t output_size;            // output image size in bytes
+    int64_t output_mtime_ns;        // output image modification time
+    int64_t face_size[6];           // input face sizes in bytes
+    int64_t face_mtime_ns[6];       // input face modification times
+    uint64_t face_hash[6];          // input face content hashes (0 when faces were not hashed)
+} FrameRecord;
+
+// Append-only record of converted frames, used to skip frames whose outputs are up to date, and to
+// find earlier outputs made from identical content. Each record is appended with a single write to
+// a file opened with O_APPEND (under an exclusive lock), so several workers can share one manifest;
+// later records for a frame replace earlier ones
+class FrameManifest {
+private:
+    int _fd;
+    std::map<int, FrameRecord> _records;
+    std::map<uint64_t, int> _content;
+
+    bool parseRecord(const char *line, FrameRecord *record);
+    void addRecord(const FrameRecord& record);
+
+public:
+    FrameManifest();
+    ~FrameManifest();
+
+    bool open(std::string path);
+    const FrameRecord* find(int number);
+    const FrameRecord* findContent(uint64_t content_key);
+    bool append(const FrameRecord& record);
+
+    static uint64_t contentKey(uint64_t params_hash, const uint64_t face_hash[6]);
+};
+
+#endif // FRAMEMANIFEST_H
@@ -0,0 +1,126 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include <sys/types.h>
+#include "frameindex.h"
+#include "shmring.h"
+
+typedef struct SourceFrame {
+    int number;                     // position in the stream (counting from 0)
+    const uint8_t *faces[6];        // first (top left) RGBA pixel of each face (left, right, bottom, top, back, front)
+    int width[6];                   // width of each face in pixels
+    int height[6];                  // height of each face in pixels
+    int row_length;                 // pixels per row of the image holding the faces
+    int64_t timestamp_ns;           // when the producer made the frame, or it was read (CLOCK_MONOTONIC)
+} SourceFrame;
+
+// Cubemap frames that arrive already decoded, in order, from a stream rather than as indexed image
+// files. Like the converter itself, a source is iterated with hasMoreFrames (which waits for the next
+// frame, and is false at the end of the stream) and nextFrame. A frame stays valid until the next call
+// to either. isFrameWaiting tells whether a later frame has already arrived (so a late one can be dropped)
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    virtual const char* name() = 0;
+    virtual bool hasMoreFrames() = 0;
+    virtual const SourceFrame& nextFrame() = 0;
+    virtual bool isFrameWaiting() = 0;
+    virtual std::string getError() = 0;
+};
+
+// Frames read from a pipe: PAM images (RGBA) written by a decoder process (e.g. ffmpeg) that it
+// starts, or raw RGBA faces on a stream it is given (such as stdin). A background thread reads ahead
+// into a few reusable buffers, so producing frames overlaps conversion, and faces are used in place
+class PipeSource : public FrameSource {
+private:
+    enum StreamFormat {STREAM_PAM, STREAM_RAW};
+    typedef struct Image {
+        std::vector<uint8_t> pixels;
+        int width;
+        int height;
+        int64_t timestamp_ns;
+    } Image;
+
+    pid_t _pid;
+    int _fd;
+    int _wake_fd;
+    StreamFormat _format;
+    int _raw_width;
+    int _raw_height;
+    CubeLayout _layout;
+    std::string _decoder;
+    std::vector<uint8_t> _buffer;
+    size_t _buffer_pos;
+    size_t _buffer_end;
+    Image _images[3];
+    std::deque<int> _free;
+    std::deque<int> _ready;
+    int _current;
+    int _frame_count;
+    SourceFrame _frame;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _ended;
+    bool _stop;
+    std::string _error;
+
+    void run();
+    bool readImage(Image& image, std::string *error);
+    bool readRawFaces(Image& image, std::string *error);
+    bool readLine(std::string& line);
+    bool readBytes(uint8_t *data, size_t length);
+    ssize_t readSome(uint8_t *data, size_t length);
+    std::string finishDecoder();
+
+public:
+    PipeSource();
+    ~PipeSource();
+
+    static bool isVideoPath(std::string path);
+
+    bool start(std::string decoder, const std::vector<std::string>& paths, const CubeLayout& layout);
+    void openRaw(int fd, int face_width, int face_height);
+    const char* name();
+    bool hasMoreFrames();
+    const SourceFrame& nextFrame();
+    bool isFrameWaiting();
+    std::string getError();
+};
+
+// Frames read in place from a shared memory ring (see shmring.h) that a co-located renderer publishes
+// six RGBA faces to. Faces are uploaded straight from the shared pages, and each slot goes back to the
+// producer once the next frame is requested
+class ShmSource : public FrameSource {
+private:
+    ShmRing _ring;
+    std::string _name;
+    bool _holding;
+    int _frame_count;
+    SourceFrame _frame;
+    const uint8_t *_data;
+    int64_t _number;
+    int64_t _timestamp;
+    std::string _error;
+
+public:
+    ShmSource();
+    ~ShmSource();
+
+    bool open(std::string name);
+    const char* name();
+    bool hasMoreFrames();
+    const SourceFrame& nextFrame();
+    bool isFrameWaiting();
+    std::string getError();
+};
+
+#endif // FRAMESOURCE_H
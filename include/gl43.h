@@ -0,0 +1,27 @@
+#ifndef GL43_H
+#define GL43_H
+
+#include <glad/gl.h>
+
+// OpenGL 4.3 entry points used by the compute shader pipeline (the bundled GLAD loader only
+// covers OpenGL 3.3)
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#define GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS 0x90EB
+#define GL_MAX_COMPUTE_WORK_GROUP_SIZE 0x91BF
+
+typedef void (GLAD_API_PTR *PFNGLDISPATCHCOMPUTEPROC)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (GLAD_API_PTR *PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+
+extern PFNGLDISPATCHCOMPUTEPROC gl43_glDispatchCompute;
+#define glDispatchCompute gl43_glDispatchCompute
+extern PFNGLMEMORYBARRIERPROC gl43_glMemoryBarrier;
+#define glMemoryBarrier gl43_glMemoryBarrier
+
+// Loads the OpenGL 4.3 entry points from the current context. Returns false if the context is
+// older than 4.3 or an entry point is missing
+bool gl43LoadCompute();
+
+#endif // GL43_H
@@ -6,11 +6,13 @@
 #include <glad/gl.h>
 
 namespace glsl {
-    GLuint createShaderProgram(const char *vert_filename, const char *frag_filename);
-    void linkShaderProgram(GLuint program);
+    GLuint createShaderProgram(const char *vert_filename, const char *frag_filename, const char *defines = "", const char *frag_library = NULL);
+    GLuint createComputeShaderProgram(const char *comp_filename, const char *defines = "", const char *library = NULL);
+    bool linkShaderProgram(GLuint program);
     void getShaderProgramUniforms(GLuint program, std::map<std::string,GLint>& uniforms);
 
-    static GLint compileShader(char *source, int32_t length, GLenum type);
+    static GLint compileShader(char *source, int32_t length, std::string header, GLenum type);
+    static std::string readLibrary(const char *filename);
     static GLuint attachShaders(GLuint shaders[], uint16_t num_shaders);
     static std::string shaderTypeToString(GLenum type);
     static int32_t readFile(const char* filename, char** data_ptr);
@@ -4,14 +4,105 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
+#include <algorithm>
+#include <vector>
 #include "stb_image.h"
 #include "stb_image_write.h"
 
+#ifdef IIO_USE_LIBJPEG
+#include <csetjmp>
+#include <jpeglib.h>
+
+typedef struct IioJpegError {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} IioJpegError;
+
+static void iioJpegErrorExit(j_common_ptr cinfo)
+{
+    IioJpegError *err = (IioJpegError*)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+// Decodes an in-memory JPEG with libjpeg, using DCT-domain scaling (1/2, 1/4, or 1/8) to shrink the
+// image as far as possible while keeping both dimensions at or above `min_size`. Returns NULL on failure
+static uint8_t* iioReadJpegScaled(const uint8_t *data, size_t size, int min_size, int *width, int *height, int *channels)
+{
+    struct jpeg_decompress_struct cinfo;
+    IioJpegError err;
+    uint8_t *volatile pixels = NULL;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = iioJpegErrorExit;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        free(pixels);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char*)data, size);
+    jpeg_read_header(&cinfo, TRUE);
+    int file_channels = cinfo.num_components;
+
+    // Pick the largest reduction that still satisfies the requested minimum size
+    int denom;
+    cinfo.scale_num = 1;
+    for (denom = 8; denom > 1; denom /= 2)
+    {
+        cinfo.scale_denom = denom;
+        jpeg_calc_output_dimensions(&cinfo);
+        if ((int)cinfo.output_width >= min_size && (int)cinfo.output_height >= min_size) break;
+    }
+    cinfo.scale_denom = denom;
+    cinfo.out_color_space = JCS_EXT_RGBA;
+    jpeg_start_decompress(&cinfo);
+
+    int stride = cinfo.output_width * 4;
+    pixels = (uint8_t*)malloc(stride * cinfo.output_height);
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = (JSAMPROW)(pixels + cinfo.output_scanline * stride);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    *channels = file_channels;
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+#endif // IIO_USE_LIBJPEG
+
 uint8_t* iioReadImage(const char *filename, int *width, int *height, int *channels)
 {
     return stbi_load(filename, width, height, channels, *channels);
 }
 
+// Same as `iioReadImage`, for an image file already read into memory
+uint8_t* iioReadImageFromMemory(const uint8_t *data, size_t size, int *width, int *height, int *channels)
+{
+    return stbi_load_from_memory(data, (int)size, width, height, channels, *channels);
+}
+
+// Same as `iioReadImageFromMemory`, but allows codecs that support it to decode at a reduced
+// resolution, as long as both dimensions remain at least `min_size` pixels. Other codecs decode at
+// full resolution
+uint8_t* iioReadImageScaledFromMemory(const uint8_t *data, size_t size, int min_size, int *width, int *height, int *channels)
+{
+#ifdef IIO_USE_LIBJPEG
+    // libjpeg only outputs RGBA, so other channel requests go through stb_image
+    if (*channels == 4 && size >= 2 && data[0] == 0xFF && data[1] == 0xD8)
+    {
+        uint8_t *pixels = iioReadJpegScaled(data, size, min_size, width, height, channels);
+        if (pixels != NULL) return pixels;
+    }
+#endif
+    return iioReadImageFromMemory(data, size, width, height, channels);
+}
+
 void iioFreeImage(uint8_t *image)
 {
     stbi_image_free(image);
@@ -27,5 +118,75 @@ int iioWriteImagePng(const char *filename, int width, int height, int channels,
     return stbi_write_png(filename, width, height, channels, pixels, width * channels);
 }
 
-#endif // IMAGEIO_HPP
+static void iioAppendToVector(void *context, void *data, int size)
+{
+    std::vector<uint8_t> *encoded = (std::vector<uint8_t>*)context;
+    size_t offset = encoded->size();
+    encoded->resize(offset + size);
+    memcpy(encoded->data() + offset, data, size);
+}
+
+// Encode to memory, replacing the contents of `encoded` (whose capacity is reused)
+int iioEncodeImageJpeg(std::vector<uint8_t>& encoded, int width, int height, int channels, int quality, uint8_t *pixels)
+{
+    encoded.clear();
+    return stbi_write_jpg_to_func(iioAppendToVector, &encoded, width, height, channels, pixels, quality);
+}
+
+int iioEncodeImagePng(std::vector<uint8_t>& encoded, int width, int height, int channels, uint8_t *pixels)
+{
+    encoded.clear();
+    return stbi_write_png_to_func(iioAppendToVector, &encoded, width, height, channels, pixels, width * channels);
+}
 
+// YUV4MPEG2 stream header for 4:2:0 frames (BT.601, limited range)
+void iioEncodeY4mHeader(std::vector<uint8_t>& encoded, int width, int height, int framerate)
+{
+    char header[128];
+    int length = snprintf(header, 128, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, framerate);
+    encoded.assign(header, header + length);
+}
+
+// One YUV4MPEG2 frame: 'FRAME', then the Y plane and the U and V planes at half resolution (each
+// chroma sample from the average of up to 2x2 pixels)
+int iioEncodeY4mFrame(std::vector<uint8_t>& encoded, int width, int height, int channels, uint8_t *pixels)
+{
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    size_t luma_size = (size_t)width * height;
+    size_t chroma_size = (size_t)chroma_width * chroma_height;
+    encoded.resize(6 + luma_size + 2 * chroma_size);
+    memcpy(encoded.data(), "FRAME\n", 6);
+    uint8_t *y_plane = encoded.data() + 6;
+    uint8_t *u_plane = y_plane + luma_size;
+    uint8_t *v_plane = u_plane + chroma_size;
+
+    int x, y;
+    for (y = 0; y < height; y++)
+    {
+        const uint8_t *row = pixels + (size_t)y * width * channels;
+        for (x = 0; x < width; x++)
+        {
+            const uint8_t *p = row + x * channels;
+            y_plane[(size_t)y * width + x] = (uint8_t)(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+        }
+    }
+    for (y = 0; y < chroma_height; y++)
+    {
+        const uint8_t *row0 = pixels + (size_t)(2 * y) * width * channels;
+        const uint8_t *row1 = pixels + (size_t)std::min(2 * y + 1, height - 1) * width * channels;
+        for (x = 0; x < chroma_width; x++)
+        {
+            int x0 = 2 * x * channels;
+            int x1 = std::min(2 * x + 1, width - 1) * channels;
+            int r = row0[x0] + row0[x1] + row1[x0] + row1[x1];
+            int g = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+            int b = row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2];
+            u_plane[(size_t)y * chroma_width + x] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+            v_plane[(size_t)y * chroma_width + x] = (uint8_t)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+        }
+    }
+    return 1;
+}
+
+#endif // IMAGEIO_HPP
@@ -0,0 +1,8 @@
+#ifndef IOBENCH_H
+#define IOBENCH_H
+
+#include <string>
+
+bool runIoBenchmark(std::string directory, int num_threads);
+
+#endif // IOBENCH_H
@@ -0,0 +1,17 @@
+#ifndef JOBMANIFEST_H
+#define JOBMANIFEST_H
+
+#include <string>
+#include <vector>
+#include "jobrunner.h"
+
+// A batch of conversions, as a JSON array of objects, or CSV with one job per line:
+//   [{"input": "shots/a", "output": "out/a", "width": 4096, "format": "jpg"}, ...]
+//   input,output,width,format          (optional header line naming the columns in any order, each once,
+//                                       input and output included; '#' starts a comment line)
+//   shots/a,out/a,4096,jpg
+// Width and format may be left out (or empty), taking the values in `defaults`. Relative paths are
+// relative to the manifest's directory
+bool readJobManifest(std::string path, const ConversionJob& defaults, std::vector<ConversionJob> *jobs, std::string *error);
+
+#endif // JOBMANIFEST_H
@@ -0,0 +1,71 @@
+#ifndef JOBRUNNER_H
+#define JOBRUNNER_H
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "cube2equirect.h"
+#include "rendercontext.h"
+
+typedef struct ConversionJob {
+    std::string user;               // who submitted the job (workers take turns between users)...
+    std::string client;             // ...and the name it was submitted under (a user's clients take turns)
+    std::string input;              // directory (or tar/zip archive) with cubemap images
+    std::string output;             // output directory (or '.tar'/'.pack' container)
+    int width;                      // output width (the height is half of it)
+    std::string format;             // output image format ('jpg' or 'png', or '' for the input's)
+    bool done;                      // set once the job has finished...
+    bool ok;                        // ...and whether it succeeded...
+    std::string error;              // ...or why it failed
+    int frames;                     // frames converted
+    double elapsed_ms;              // time from a worker taking the job to finishing it
+    int worker;                     // worker that ran the job
+    bool warm;                      // every GL object the job needed was kept from an earlier job
+} ConversionJob;
+
+// Converts jobs on a pool of workers, each with its own OpenGL context and RenderCache, so only a
+// worker's first job with a given program, mesh, or output size pays to set it up. Pending jobs are
+// queued per user, and within that per client name. A worker that becomes free takes the next user in
+// turn (round robin), and of that user's clients the next one in turn, so one user's backlog cannot
+// hold up the others however many client names it is spread over. Within a client's queue, a worker
+// prefers a job at the width it last converted (its render surface and remap table are ready), passing
+// over the oldest job at most MAX_PASSED_OVER times
+class JobRunner {
+private:
+    static const int MAX_PASSED_OVER = 4;
+
+    typedef std::map<std::string,std::deque<ConversionJob*>> ClientQueues;
+
+    C2EOptions _options;
+    std::vector<RenderContext*> _contexts;
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _job_queued;
+    std::condition_variable _job_done;
+    std::map<std::string,ClientQueues> _queues; // pending jobs per user, then per client
+    std::string _last_user;
+    std::map<std::string,std::string> _last_client; // client each user with pending jobs was served last
+    std::map<std::string,int> _passed_over;     // times each client's oldest job was passed over (by user and client)
+    std::vector<int> _last_width;               // width each worker converted last
+    bool _stopping;
+
+    void runWorker(int index);
+    ConversionJob* takeJob(int index);
+    void runJob(int index, RenderCache *cache, ConversionJob *job);
+    void finishJob(ConversionJob *job, bool ok, std::string error);
+
+public:
+    JobRunner();
+    ~JobRunner();
+
+    bool start(int num_workers, C2EOptions options);
+    bool submit(ConversionJob *job);
+    void wait(ConversionJob *job);
+    void stop();
+};
+
+#endif // JOBRUNNER_H
@@ -0,0 +1,29 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <vector>
+#include <cstdint>
+
+// Histogram of durations with bounded relative error, in the manner of HdrHistogram: values (in
+// microseconds) below 128 get a bucket each, and every power of two above that is split into 64
+// linear buckets, so percentiles keep about 1.5% precision from 1 us to hours in a few KB
+class LatencyHistogram {
+private:
+    std::vector<int64_t> _counts;
+    int64_t _total;
+    int64_t _max_us;
+
+    static int bucketOf(int64_t us);
+    static int64_t highestValueIn(int bucket);
+
+public:
+    LatencyHistogram();
+    ~LatencyHistogram();
+
+    void record(double ms);
+    int64_t count();
+    double percentile(double p);
+    double max();
+};
+
+#endif // LATENCYHISTOGRAM_H
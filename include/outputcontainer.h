@@ -0,0 +1,42 @@
+#ifndef OUTPUTCONTAINER_H
+#define OUTPUTCONTAINER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+enum ContainerFormat {CONTAINER_NONE, CONTAINER_TAR, CONTAINER_PACK};
+
+// Layout of a single file holding a whole sequence of encoded frames, appended in order:
+//   tar:  a ustar stream (a 512 byte header before each member, padded to 512 bytes), so any tar
+//         tool can list and extract it
+//   pack: 'C2EPACK1', then each frame as <u64 length><data>; then an index of
+//         <u64 offset><u64 length><u16 name length><name> per frame, and a 24 byte trailer of
+//         <u64 index offset><u64 count>'C2EINDEX' (all little-endian), so a reader can seek to any
+//         frame from the end of the file
+// Records are placed at offsets computed up front, so they can be written in parallel
+class OutputContainer {
+private:
+    typedef struct Entry {
+        std::string name;
+        int64_t offset;
+        int64_t length;
+    } Entry;
+
+    ContainerFormat _format;
+    int64_t _size;
+    std::vector<Entry> _entries;
+
+public:
+    static ContainerFormat formatFromPath(std::string path);
+
+    OutputContainer(ContainerFormat format);
+    ~OutputContainer();
+
+    int64_t begin(std::vector<uint8_t>& bytes);
+    int64_t append(std::string name, const std::vector<uint8_t>& data, std::vector<uint8_t>& record);
+    int64_t finish(std::vector<uint8_t>& bytes);
+    size_t count();
+};
+
+#endif // OUTPUTCONTAINER_H
@@ -0,0 +1,86 @@
+#ifndef OUTPUTWRITER_H
+#define OUTPUTWRITER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include "asyncio.h"
+#include "outputcontainer.h"
+
+typedef struct WriterStats {
+    int64_t files;                  // files written
+    int64_t bytes;                  // bytes written
+    int64_t stalls;                 // writes that waited for room in the queue
+    double stall_ms;                // time spent waiting for room in the queue
+    int64_t sync_batches;           // batches of files flushed to storage together
+} WriterStats;
+
+// Writes encoded files in the background, so the caller only waits when the bytes queued (not yet
+// written) would exceed a budget. All queued files are written as one batch of AsyncIO requests, to
+// a temporary name that is renamed into place once written. In durable mode, files are collected
+// into batches of `sync_batch`, whose data syncs are submitted together before the renames (followed
+// by one sync of the directory), instead of syncing each file on its own. With a container, files
+// are instead appended to one file as its members (which is renamed into place when finished), and
+// with a stream, their data is written in order to a pipe (such as stdout)
+class OutputWriter {
+private:
+    typedef struct Job {
+        std::string path;
+        std::string tmp_path;
+        std::vector<uint8_t> data;
+        int fd;
+        int64_t file_offset;
+        size_t offset;
+        bool ok;
+    } Job;
+
+    std::mutex _mutex;
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+    std::thread _thread;
+    AsyncIO *_io;
+    std::deque<Job*> _queue;
+    std::vector<std::vector<uint8_t> > _pool;
+    int64_t _budget;
+    int64_t _bytes_queued;
+    int _sync_batch;
+    int64_t _submitted;
+    int64_t _finished;
+    bool _waiting;
+    std::string _failed_path;
+    OutputContainer *_container;
+    int _container_fd;
+    std::string _container_path;
+    std::string _container_tmp_path;
+    int _stream_fd;
+    bool _stop;
+    WriterStats _stats;
+
+    void run();
+    void writeBatch(std::vector<Job*>& batch);
+    void completeAll(std::vector<IORequest>& requests, bool writes);
+    void syncDirectories(const std::vector<std::string>& paths);
+    bool writeAll(int fd, const std::vector<uint8_t>& bytes, int64_t offset);
+    bool writeStream(const std::vector<uint8_t>& bytes);
+
+public:
+    OutputWriter();
+    ~OutputWriter();
+
+    bool start(std::string io_backend, int num_threads, int64_t budget_bytes, int sync_batch);
+    bool openContainer(std::string path);
+    bool finishContainer();
+    bool openStream(int fd, const std::vector<uint8_t>& header);
+    int64_t write(std::string path, std::vector<uint8_t>& data);
+    void flush();
+    int64_t getFinishedCount();
+    std::string getFailedPath();
+    WriterStats getStats();
+    const char* getBackendName();
+};
+
+#endif // OUTPUTWRITER_H
@@ -0,0 +1,71 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include "asyncio.h"
+
+typedef struct PrefetchStats {
+    int64_t hits;                   // files that were already read when needed
+    int64_t stalls;                 // files that were still being read when needed
+    int64_t misses;                 // files that were never requested (read synchronously instead)
+    double stall_ms;                // time spent waiting on files still being read
+    int64_t bytes_read;             // bytes read by the I/O threads
+} PrefetchStats;
+
+// Reads files in the background ahead of when they are needed. Requests are served in order, while
+// the bytes held (being read, or read but not yet taken) stay within a budget; the reads of all
+// files that fit are submitted to the AsyncIO backend in one batch. Files that cannot start yet are
+// hinted to the kernel with posix_fadvise(WILLNEED)
+class Prefetcher {
+private:
+    enum ItemState {QUEUED, READING, READY};
+    typedef struct Item {
+        int64_t size;
+        ItemState state;
+        bool advised;
+        bool urgent;
+        bool ok;
+        int fd;
+        size_t offset;
+        std::vector<uint8_t> data;
+    } Item;
+
+    std::mutex _mutex;
+    std::condition_variable _work_cv;
+    std::condition_variable _ready_cv;
+    std::thread _thread;
+    AsyncIO *_io;
+    std::map<std::string, Item> _items;
+    std::deque<std::string> _queue;
+    std::vector<std::vector<uint8_t> > _pool;
+    int64_t _budget;
+    int64_t _bytes_held;
+    size_t _in_flight;
+    bool _stop;
+    PrefetchStats _stats;
+
+    void run();
+    int openFile(const std::string& path, std::vector<uint8_t>& data);
+    IORequest readRequest(Item& item);
+    void finishItem(Item& item, bool ok);
+
+public:
+    Prefetcher();
+    ~Prefetcher();
+
+    bool start(std::string io_backend, int num_threads, int64_t budget_bytes);
+    void request(std::string path, int64_t size);
+    bool take(std::string path, std::vector<uint8_t>& data);
+    void discard(std::string path);
+    PrefetchStats getStats();
+    const char* getBackendName();
+};
+
+#endif // PREFETCHER_H
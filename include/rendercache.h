@@ -0,0 +1,47 @@
+#ifndef RENDERCACHE_H
+#define RENDERCACHE_H
+
+#include <string>
+#include <map>
+#include <cstdint>
+#include "glad/gl.h"
+
+// GL objects a conversion sets up before its first frame (shader programs, geometry, face textures,
+// and remap tables), kept with the context they were made on so later conversions with matching
+// parameters start warm. The context must be current whenever the cache is used or destroyed
+class RenderCache {
+public:
+    typedef struct Program {
+        GLuint program;
+        std::map<std::string,GLint> uniforms;
+    } Program;
+
+    typedef struct Geometry {
+        GLuint vertex_array;
+        GLuint buffers[3];              // vertex positions, texture coordinates, and indices (0 if unused)
+        GLint first[6];                 // first vertex of each face (tessellated faces only)
+        GLsizei count[6];               // vertices of each face (tessellated faces only)
+    } Geometry;
+
+private:
+    std::map<std::string,Program> _programs;    // by pipeline and shader defines
+    std::map<int,Geometry> _geometry;           // by mesh density (0 for the full-screen quad)
+    std::map<std::string,GLuint> _textures;     // by role ('face0'...'face5', 'faces', 'remap WxH')
+    int64_t _hits;
+    int64_t _misses;
+
+public:
+    RenderCache();
+    ~RenderCache();
+
+    Program* findProgram(std::string key);
+    Program* addProgram(std::string key, const Program& program);
+    Geometry* findGeometry(int mesh_density);
+    Geometry* addGeometry(int mesh_density, const Geometry& geometry);
+    GLuint findTexture(std::string key);
+    void addTexture(std::string key, GLuint texture);
+    int64_t getHits();
+    int64_t getMisses();
+};
+
+#endif // RENDERCACHE_H
@@ -0,0 +1,35 @@
+#ifndef RENDERCONTEXT_H
+#define RENDERCONTEXT_H
+
+#include <map>
+#include <utility>
+#include "glad/egl.h"
+#include "glad/gl.h"
+
+// An OpenGL context on the default EGL display, rendering to an off-screen pbuffer of the output
+// size. Each output size gets its own pbuffer, kept for later conversions of that size. A context is
+// current on one thread at a time (the daemon and batch workers each have their own)
+class RenderContext {
+private:
+    static EGLDisplay _display;
+    static EGLConfig _config;
+    static bool _gl_loaded;
+
+    EGLContext _context;
+    EGLSurface _surface;
+    std::map<std::pair<int,int>,EGLSurface> _surfaces;
+
+public:
+    RenderContext();
+    ~RenderContext();
+
+    static bool initialize();
+    static void terminate();
+
+    bool create(bool compute);
+    bool makeCurrent(int width, int height);
+    void release();
+    void swapBuffers();
+};
+
+#endif // RENDERCONTEXT_H
@@ -0,0 +1,31 @@
+#ifndef SHARDMANIFEST_H
+#define SHARDMANIFEST_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+typedef struct ShardFrame {
+    int number;                     // source frame number
+    std::string file;               // output image file name (relative to the output directory)
+    int64_t size;                   // output image size in bytes
+} ShardFrame;
+
+// Record of the frames one shard wrote, so a merge step can check that all shards finished
+typedef struct ShardManifest {
+    int shard_index;                // 0-based shard index
+    int shard_count;                // number of shards the range was split into
+    int frame_start;                // frame range the shards were selected from
+    int frame_end;
+    int frame_stride;
+    int64_t range_frames;           // frames in the range across all shards
+    std::vector<ShardFrame> frames; // frames written by this shard, in order
+    bool complete;                  // the shard ran to completion
+} ShardManifest;
+
+std::string shardManifestName(int shard_index, int shard_count);
+bool writeShardManifest(std::string output_dir, const ShardManifest& manifest);
+bool readShardManifest(std::string path, ShardManifest *manifest);
+bool listShardManifests(std::string dir, std::vector<std::string> *paths);
+
+#endif // SHARDMANIFEST_H
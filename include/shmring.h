@@ -0,0 +1,82 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+enum ShmRingFormat {RING_FACES = 0, RING_IMAGE = 1};
+
+// Shared memory layout (native byte order), at the start of the POSIX shared memory object:
+//   the header below, then `slot_count` ShmRingSlot records, then the slots' pixel data, each slot
+//   starting on a page boundary at `data_offset + index * slot_size`
+typedef struct ShmRingHeader {
+    char magic[8];                  // 'C2ERING1' (written last by the creator, once the rest is set)
+    uint32_t slot_count;            // number of frames the ring holds
+    uint32_t format;                // RING_FACES: six RGBA faces (left, right, bottom, top, back, front)
+                                    // of width x height, one after the other; RING_IMAGE: one RGBA image
+    uint32_t width;                 // width of each face (or of the image) in pixels
+    uint32_t height;                // height of each face (or of the image) in pixels
+    uint64_t slot_size;             // bytes from one slot's data to the next
+    uint64_t data_offset;           // offset of the first slot's data
+    uint32_t closed;                // set to 1 by the producer after its last frame
+    uint32_t consumer_pid;          // process id of the consumer, set when it attaches (0 before)
+    uint32_t reserved[4];
+    alignas(64) uint32_t write_seq; // frames published by the producer (futex word)
+    alignas(64) uint32_t read_seq;  // frames released by the consumer (futex word)
+} ShmRingHeader;
+
+typedef struct ShmRingSlot {
+    int64_t frame;                  // frame number
+    int64_t timestamp_ns;           // when the frame was made (CLOCK_MONOTONIC), carried from input to output
+} ShmRingSlot;
+
+// Single producer, single consumer ring of frames in POSIX shared memory. Frame `n` lives in slot
+// `n % slot_count`. The producer fills a slot once `write_seq - read_seq < slot_count`, then
+// increments `write_seq`; the consumer reads slots while `read_seq < write_seq`, then increments
+// `read_seq`. Each side waits on the other's counter with a futex and wakes it after updating its own.
+// The producer stops waiting once the consumer's process has exited, or the consumer has not released
+// a frame (or never attached) for CONSUMER_TIMEOUT_MS. The creator unlinks the ring when it is
+// destroyed, and also if the process exits or is ended by SIGINT, SIGTERM, or SIGHUP
+class ShmRing {
+private:
+    static const int CONSUMER_TIMEOUT_MS = 30000;
+
+    int _fd;
+    uint8_t *_base;
+    size_t _size;
+    ShmRingHeader *_header;
+    ShmRingSlot *_slots;
+    std::string _name;
+    bool _owner;
+    uint32_t _next;
+
+    bool isConsumerAlive(std::chrono::steady_clock::time_point last_release);
+    void futexWait(uint32_t *word, uint32_t value);
+    void futexWake(uint32_t *word);
+    static void registerOwnedName(const std::string& name, bool owned);
+    static void unlinkOwnedNames();
+    static void unlinkOwnedNamesOnSignal(int signal_number);
+
+public:
+    ShmRing();
+    ~ShmRing();
+
+    bool create(std::string name, ShmRingFormat format, int width, int height, int slot_count);
+    bool open(std::string name);
+    ShmRingFormat getFormat();
+    int getWidth();
+    int getHeight();
+
+    uint8_t* acquireWrite();
+    void publish(int64_t frame, int64_t timestamp_ns);
+    void close();
+    bool drain();
+
+    bool acquireRead(const uint8_t **data, int64_t *frame, int64_t *timestamp_ns);
+    bool isFrameWaiting();
+    void release();
+};
+
+#endif // SHMRING_H
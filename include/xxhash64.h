@@ -0,0 +1,10 @@
+#ifndef XXHASH64_H
+#define XXHASH64_H
+
+#include <cstddef>
+#include <cstdint>
+
+// XXH64 (https://github.com/Cyan4973/xxHash), used to fingerprint input faces
+uint64_t xxh64(const void *data, size_t length, uint64_t seed);
+
+#endif // XXHASH64_H
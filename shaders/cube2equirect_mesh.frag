@@ -0,0 +1,12 @@
+#version 330
+
+in vec2 texcoord;
+
+uniform sampler2D cube_face;
+
+out vec4 FragColor;
+
+void main() {
+	// Mesh vertices carry face coordinates, so the rasterizer has already done the mapping
+	FragColor = texture(cube_face, texcoord);
+}
@@ -0,0 +1,19 @@
+#version 330
+
+uniform sampler2D remap;
+uniform sampler2DArray cube_faces;
+uniform float face_lod_bias;
+uniform int face_mask;
+
+out vec4 FragColor;
+
+void main() {
+	// Face coordinate, face index, and footprint were precomputed for every output pixel
+	// (see Cube2Equirect::createRemapTexture)
+	vec4 mapping = texelFetch(remap, ivec2(gl_FragCoord.xy), 0);
+	if (((face_mask >> int(mapping.b * 5.0 + 0.5)) & 1) == 0) {
+		discard;
+	}
+	float lod = face_lod_bias - mapping.a * 32.0;
+	FragColor = textureLod(cube_faces, vec3(mapping.rg, mapping.b * 5.0), lod);
+}
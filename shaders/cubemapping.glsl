@@ -0,0 +1,141 @@
+// Equirectangular to cube face mapping shared by the conversion shaders (inserted after the
+// '#version' line and any defines)
+
+#define M_PI 3.1415926535897932384626433832795
+
+uniform vec2 output_size;
+uniform int max_samples;
+uniform int face_mask;
+uniform sampler2D cube_left;
+uniform sampler2D cube_right;
+uniform sampler2D cube_bottom;
+uniform sampler2D cube_top;
+uniform sampler2D cube_back;
+uniform sampler2D cube_front;
+
+// Face coordinate (px) and its derivatives across one output pixel (dpx_dx, dpx_dy)
+struct FaceCoord {
+	int face;
+	vec2 px;
+	vec2 dpx_dx;
+	vec2 dpx_dy;
+};
+
+// Derivative of a face coordinate (0.5 + 0.5 * dot(dir, axis) / dot(dir, major)) along `ddir`
+vec2 faceDerivative(vec3 dir, vec3 ddir, vec3 major, vec3 u_axis, vec3 v_axis) {
+	float m = dot(dir, major);
+	float dm = dot(ddir, major);
+	vec2 uv = vec2(dot(dir, u_axis), dot(dir, v_axis));
+	vec2 duv = vec2(dot(ddir, u_axis), dot(ddir, v_axis));
+	return 0.5 * (duv * m - uv * dm) / (m * m);
+}
+
+// Index of the cube face the direction `dir` points at
+int cubeFace(vec3 dir) {
+	vec3 a = abs(dir);
+	if (a.x >= a.y && a.x >= a.z) return (dir.x < 0.0) ? 0 : 1;
+	else if (a.y >= a.z)          return (dir.y < 0.0) ? 3 : 2;
+	else                          return (dir.z < 0.0) ? 4 : 5;
+}
+
+// Projects the direction at longitude `theta` and latitude `phi` onto the cube
+FaceCoord mapToCube(float theta, float phi, vec2 pixel_angle) {
+	float x = cos(phi) * sin(theta);
+	float y = sin(phi);
+	float z = cos(phi) * cos(theta);
+	vec3 dir = vec3(x, y, z);
+
+	// Change in view direction from one output pixel to the next. These are computed analytically
+	// (rather than with implicit derivatives) so they stay continuous across cube face edges
+	vec3 ddir_dx = vec3(cos(phi) * cos(theta), 0.0, -cos(phi) * sin(theta)) * pixel_angle.x;
+	vec3 ddir_dy = vec3(-sin(phi) * sin(theta), cos(phi), -sin(phi) * cos(theta)) * pixel_angle.y;
+
+	vec3 major;
+	vec3 u_axis;
+	vec3 v_axis;
+	FaceCoord fc;
+
+	fc.face = cubeFace(dir);
+	if      (fc.face == 0) { major = vec3(-1.0,  0.0,  0.0); u_axis = vec3( 0.0, 0.0,  1.0); v_axis = vec3(0.0, 1.0,  0.0); }
+	else if (fc.face == 1) { major = vec3( 1.0,  0.0,  0.0); u_axis = vec3( 0.0, 0.0, -1.0); v_axis = vec3(0.0, 1.0,  0.0); }
+	else if (fc.face == 2) { major = vec3( 0.0,  1.0,  0.0); u_axis = vec3( 1.0, 0.0,  0.0); v_axis = vec3(0.0, 0.0, -1.0); }
+	else if (fc.face == 3) { major = vec3( 0.0, -1.0,  0.0); u_axis = vec3( 1.0, 0.0,  0.0); v_axis = vec3(0.0, 0.0,  1.0); }
+	else if (fc.face == 4) { major = vec3( 0.0,  0.0, -1.0); u_axis = vec3(-1.0, 0.0,  0.0); v_axis = vec3(0.0, 1.0,  0.0); }
+	else                   { major = vec3( 0.0,  0.0,  1.0); u_axis = vec3( 1.0, 0.0,  0.0); v_axis = vec3(0.0, 1.0,  0.0); }
+
+	float scale = 1.0 / dot(dir, major);
+	fc.px = (vec2(dot(dir, u_axis), dot(dir, v_axis)) * scale + 1.0) / 2.0;
+	fc.dpx_dx = faceDerivative(dir, ddir_dx, major, u_axis, v_axis);
+	fc.dpx_dy = faceDerivative(dir, ddir_dy, major, u_axis, v_axis);
+	return fc;
+}
+
+vec4 sampleFace(FaceCoord fc) {
+	if      (fc.face == 0) return textureGrad(cube_left,   fc.px, fc.dpx_dx, fc.dpx_dy);
+	else if (fc.face == 1) return textureGrad(cube_right,  fc.px, fc.dpx_dx, fc.dpx_dy);
+	else if (fc.face == 2) return textureGrad(cube_bottom, fc.px, fc.dpx_dx, fc.dpx_dy);
+	else if (fc.face == 3) return textureGrad(cube_top,    fc.px, fc.dpx_dx, fc.dpx_dy);
+	else if (fc.face == 4) return textureGrad(cube_back,   fc.px, fc.dpx_dx, fc.dpx_dy);
+	else                   return textureGrad(cube_front,  fc.px, fc.dpx_dx, fc.dpx_dy);
+}
+
+float faceSize(int face) {
+	if      (face == 0) return float(textureSize(cube_left,   0).x);
+	else if (face == 1) return float(textureSize(cube_right,  0).x);
+	else if (face == 2) return float(textureSize(cube_bottom, 0).x);
+	else if (face == 3) return float(textureSize(cube_top,    0).x);
+	else if (face == 4) return float(textureSize(cube_back,   0).x);
+	else                return float(textureSize(cube_front,  0).x);
+}
+
+// Number of samples per axis needed to cover the pixel's footprint on the cube: one per texel
+// when minified, and the maximum when the footprint straddles a face edge
+// (keep in sync with eqmap::adaptiveSamples)
+int adaptiveSamples(FaceCoord fc) {
+	vec2 extent = (abs(fc.dpx_dx) + abs(fc.dpx_dy)) * 0.5;
+	if (any(lessThan(min(fc.px, 1.0 - fc.px), extent))) {
+		return max_samples;
+	}
+	float footprint = max(length(fc.dpx_dx), length(fc.dpx_dy)) * faceSize(fc.face);
+	return clamp(int(ceil(footprint - 0.001)), 1, max_samples);
+}
+
+// Whether the output pixel at `texcoord` is fed by one of the faces in `face_mask` (bit N set for
+// face N), so partial updates only touch pixels whose face changed (single sample per pixel only)
+bool faceSelected(vec2 texcoord) {
+	if (face_mask == 0x3F) {
+		return true;
+	}
+	float theta = texcoord.x * M_PI;
+	float phi = (texcoord.y * M_PI) / 2.0;
+	vec3 dir = vec3(cos(phi) * sin(theta), sin(phi), cos(phi) * cos(theta));
+	return ((face_mask >> cubeFace(dir)) & 1) != 0;
+}
+
+// Color of the output pixel at `texcoord`, where (-1, -1) is the bottom left corner of the output
+// and (1, 1) the top right
+vec4 sampleEquirect(vec2 texcoord) {
+	float theta = texcoord.x * M_PI;
+	float phi = (texcoord.y * M_PI) / 2.0;
+	vec2 pixel_angle = vec2(2.0 * M_PI, M_PI) / output_size;
+
+	FaceCoord fc = mapToCube(theta, phi, pixel_angle);
+#ifndef ADAPTIVE_ANTIALIAS
+	return sampleFace(fc);
+#else
+	int n = adaptiveSamples(fc);
+	if (n == 1) {
+		return sampleFace(fc);
+	}
+
+	// Stratified n x n grid of samples across the pixel
+	vec4 sum = vec4(0.0);
+	for (int j = 0; j < n; j++) {
+		for (int i = 0; i < n; i++) {
+			vec2 offset = ((vec2(i, j) + 0.5) / float(n) - 0.5) * pixel_angle;
+			sum += sampleFace(mapToCube(theta + offset.x, phi + offset.y, pixel_angle / float(n)));
+		}
+	}
+	return sum / float(n * n);
+#endif
+}
@@ -0,0 +1,283 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "asyncio.h"
+
+// Returns the requested backend ('uring' or 'threads'), or io_uring with a fallback to threads
+// ('auto'). Returns NULL if io_uring was requested but is not available
+AsyncIO* AsyncIO::create(std::string backend, int num_threads)
+{
+    if (backend != "threads")
+    {
+        UringIO *uring = new UringIO();
+        if (uring->init(64))
+        {
+            return uring;
+        }
+        delete uring;
+        if (backend == "uring")
+        {
+            return NULL;
+        }
+    }
+    return new ThreadPoolIO(num_threads);
+}
+
+
+UringIO::UringIO()
+{
+    _ring_fd = -1;
+    _sq_ptr = MAP_FAILED;
+    _cq_ptr = MAP_FAILED;
+    _sqes = MAP_FAILED;
+    _in_flight = 0;
+}
+
+UringIO::~UringIO()
+{
+    // Completions still in flight would write into freed buffers, so wait for them first
+    std::vector<IOCompletion> completions;
+    while (_ring_fd >= 0 && (_in_flight > 0 || !_backlog.empty()))
+    {
+        wait(completions, 1);
+        completions.clear();
+    }
+    if (_sqes != MAP_FAILED) munmap(_sqes, _sqes_size);
+    if (_cq_ptr != MAP_FAILED && _cq_ptr != _sq_ptr) munmap(_cq_ptr, _cq_size);
+    if (_sq_ptr != MAP_FAILED) munmap(_sq_ptr, _sq_size);
+    if (_ring_fd >= 0) close(_ring_fd);
+}
+
+// Public
+bool UringIO::init(unsigned int entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    _ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (_ring_fd < 0)
+    {
+        return false;
+    }
+    _entries = params.sq_entries;
+
+    // Map the rings (a single mapping serves both when the kernel supports it)
+    _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap)
+    {
+        if (_cq_size > _sq_size) _sq_size = _cq_size;
+        _cq_size = _sq_size;
+    }
+    _sq_ptr = mmap(NULL, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+    if (_sq_ptr == MAP_FAILED)
+    {
+        return false;
+    }
+    _cq_ptr = single_mmap ? _sq_ptr : mmap(NULL, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+    _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    _sqes = mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+    if (_cq_ptr == MAP_FAILED || _sqes == MAP_FAILED)
+    {
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t*)_sq_ptr;
+    _sq_head = (unsigned int*)(sq + params.sq_off.head);
+    _sq_tail = (unsigned int*)(sq + params.sq_off.tail);
+    _sq_mask = (unsigned int*)(sq + params.sq_off.ring_mask);
+    _sq_array = (unsigned int*)(sq + params.sq_off.array);
+    uint8_t *cq = (uint8_t*)_cq_ptr;
+    _cq_head = (unsigned int*)(cq + params.cq_off.head);
+    _cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+    _cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+    _cqes = cq + params.cq_off.cqes;
+
+    return true;
+}
+
+const char* UringIO::name()
+{
+    return "io_uring";
+}
+
+// Queues the requests and submits them with a single system call (as far as the ring has room)
+void UringIO::submit(const std::vector<IORequest>& requests)
+{
+    _backlog.insert(_backlog.end(), requests.begin(), requests.end());
+    unsigned int queued = queueRequests();
+    if (queued > 0)
+    {
+        enter(queued, 0);
+    }
+}
+
+// Waits until at least `min_count` requests complete (or none are left), appending their results
+void UringIO::wait(std::vector<IOCompletion>& completions, size_t min_count)
+{
+    size_t found = 0;
+    while (found < min_count && (_in_flight > 0 || !_backlog.empty()))
+    {
+        // Reap what has completed
+        unsigned int head = *_cq_head;
+        unsigned int tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &((struct io_uring_cqe*)_cqes)[head & *_cq_mask];
+            IOCompletion completion;
+            completion.user = (void*)(uintptr_t)cqe->user_data;
+            completion.result = cqe->res;
+            completions.push_back(completion);
+            head++;
+            found++;
+            _in_flight--;
+        }
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+
+        // Completions free up ring slots for the backlog; block only if nothing completed yet
+        unsigned int queued = queueRequests();
+        if (queued > 0 || found < min_count)
+        {
+            enter(queued, (found < min_count && _in_flight > 0) ? 1 : 0);
+        }
+    }
+}
+
+// Private
+// Moves backlogged requests into free submission queue entries, returning how many were queued
+unsigned int UringIO::queueRequests()
+{
+    unsigned int queued = 0;
+    unsigned int tail = *_sq_tail;
+    while (!_backlog.empty() && _in_flight < _entries)
+    {
+        const IORequest& request = _backlog.front();
+        unsigned int index = tail & *_sq_mask;
+        struct io_uring_sqe *sqe = &((struct io_uring_sqe*)_sqes)[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = request.fd;
+        if (request.op == IO_FSYNC)
+        {
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
+        else
+        {
+            sqe->opcode = (request.op == IO_WRITE) ? IORING_OP_WRITE : IORING_OP_READ;
+            sqe->addr = (uint64_t)(uintptr_t)request.buffer;
+            sqe->len = (uint32_t)request.length;
+            sqe->off = (uint64_t)request.offset;
+        }
+        sqe->user_data = (uint64_t)(uintptr_t)request.user;
+        _sq_array[index] = index;
+        tail++;
+        queued++;
+        _in_flight++;
+        _backlog.pop_front();
+    }
+    __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+    return queued;
+}
+
+void UringIO::enter(unsigned int to_submit, unsigned int min_complete)
+{
+    unsigned int flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    while (syscall(__NR_io_uring_enter, _ring_fd, to_submit, min_complete, flags, NULL, 0) < 0 && errno == EINTR)
+    {
+        // Submitted entries are consumed even if the wait was interrupted
+        to_submit = 0;
+    }
+}
+
+
+ThreadPoolIO::ThreadPoolIO(int num_threads)
+{
+    _stop = false;
+    int i;
+    for (i = 0; i < num_threads; i++)
+    {
+        _threads.push_back(std::thread(&ThreadPoolIO::run, this));
+    }
+}
+
+ThreadPoolIO::~ThreadPoolIO()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _request_cv.notify_all();
+    size_t i;
+    for (i = 0; i < _threads.size(); i++)
+    {
+        _threads[i].join();
+    }
+}
+
+// Public
+const char* ThreadPoolIO::name()
+{
+    return "thread pool";
+}
+
+void ThreadPoolIO::submit(const std::vector<IORequest>& requests)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _requests.insert(_requests.end(), requests.begin(), requests.end());
+    _request_cv.notify_all();
+}
+
+void ThreadPoolIO::wait(std::vector<IOCompletion>& completions, size_t min_count)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    size_t found = 0;
+    while (found < min_count)
+    {
+        while (_completions.empty())
+        {
+            _complete_cv.wait(lock);
+        }
+        while (!_completions.empty())
+        {
+            completions.push_back(_completions.front());
+            _completions.pop_front();
+            found++;
+        }
+    }
+}
+
+// Private
+void ThreadPoolIO::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        while (!_stop && _requests.empty())
+        {
+            _request_cv.wait(lock);
+        }
+        // Requests still queued are finished before stopping, since their buffers are in use
+        if (_requests.empty())
+        {
+            return;
+        }
+        IORequest request = _requests.front();
+        _requests.pop_front();
+
+        lock.unlock();
+        ssize_t result;
+        if (request.op == IO_FSYNC) result = fdatasync(request.fd);
+        else if (request.op == IO_WRITE) result = pwrite(request.fd, request.buffer, request.length, request.offset);
+        else result = pread(request.fd, request.buffer, request.length, request.offset);
+        IOCompletion completion;
+        completion.user = request.user;
+        completion.result = (result < 0) ? -errno : result;
+        lock.lock();
+
+        _completions.push_back(completion);
+        _complete_cv.notify_all();
+    }
+}
@@ -1,88 +1,359 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdarg>
+#include <unistd.h>
 #include "cube2equirect.h"
+#include "eqmap.h"
+#include "gl43.h"
+#include "xxhash64.h"
 #include "imageio.hpp"
 
-Cube2Equirect::Cube2Equirect(std::string in_dir, std::string out_dir, std::string out_format, int out_w, int out_h)
+// Throws C2EError if the conversion cannot be set up
+Cube2Equirect::Cube2Equirect(std::string in_dir, std::string out_dir, std::string out_format, int out_w, int out_h, C2EOptions options, RenderCache *cache)
+{
+    // Everything release() frees starts out empty, so a conversion that fails partway through setting
+    // up can be cleaned up
+    _output_pixels = NULL;
+    _source = NULL;
+    _output_ring = NULL;
+    _cache = NULL;
+    _owns_cache = false;
+    _output_buffer = 0;
+    _previous_texture = 0;
+    _previous_framebuffer = 0;
+    _upscale_texture = 0;
+    _upscale_framebuffer = 0;
+    try
+    {
+        setup(in_dir, out_dir, out_format, out_w, out_h, options, cache);
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+}
+
+Cube2Equirect::~Cube2Equirect()
+{
+    release();
+}
+
+// Sets up the conversion (for the constructor, which cleans up if this throws)
+void Cube2Equirect::setup(std::string in_dir, std::string out_dir, std::string out_format, int out_w, int out_h, C2EOptions options, RenderCache *cache)
 {
     _input_dir = makePath(in_dir);
     _output_dir = makePath(out_dir);
+    bool container = (OutputContainer::formatFromPath(out_dir) != CONTAINER_NONE);
+    if (container)
+    {
+        size_t slash = out_dir.find_last_of('/');
+        _output_dir = (slash != std::string::npos) ? out_dir.substr(0, slash + 1) : "./";
+    }
+
+    // An output of '-' streams frames (raw RGBA or Y4M by default) to `output_fd`, with no files
+    bool stream = (out_dir == "-");
+    if (stream)
+    {
+        _output_dir = "stdout:";
+        if (out_format != "jpg" && out_format != "png" && out_format != "raw") out_format = "y4m";
+    }
+
+    // An output of 'shm:NAME' publishes raw RGBA images to a shared memory ring that the converter creates
+    bool ring_output = (out_dir.compare(0, 4, "shm:") == 0);
+    if (ring_output)
+    {
+        _output_dir = "shm:";
+        out_format = "raw";
+    }
     _output_format = out_format;
     _output_width = out_w;
     _output_height = out_h;
     _output_pixels = new uint8_t[_output_width * _output_width * 4];
+    _options = options;
+
+    // Real-time mode times each stage exactly (it converts one frame at a time anyway)
+    if (_options.deadline_ms > 0)
+    {
+        _options.stats = true;
+    }
+
+    // At the center of a face, one face pixel spans 2/N radians, while one equirect pixel spans
+    // 2*pi/W radians, so faces never need more than W/pi pixels across
+    _face_resolution = (int)ceil((double)_output_width / M_PI);
+
+    FrameIndex::findLayout(_options.layout, &_layout);
+
+    // Video input is decoded by a separate process, straight into memory
+    _source = NULL;
+    _source_frame = NULL;
+    _source_wait_ms = 0.0;
+    _output_ring = NULL;
+    _frame_timestamp_ns = 0;
+    if (in_dir.compare(0, 4, "shm:") == 0)
+    {
+        // Faces published to a shared memory ring by a co-located renderer
+        _input_dir = in_dir;
+        ShmSource *source = new ShmSource();
+        if (!source->open(makeShmName(in_dir.substr(4))))
+        {
+            fail("%s", source->getError().c_str());
+        }
+        _source = source;
+    }
+    else if (in_dir == "-")
+    {
+        // Raw faces on stdin
+        _input_dir = "stdin";
+        PipeSource *source = new PipeSource();
+        source->openRaw(STDIN_FILENO, _options.raw_face_size[0], _options.raw_face_size[1]);
+        _source = source;
+    }
+    else if (PipeSource::isVideoPath(in_dir))
+    {
+        _input_dir = in_dir;
+        std::vector<std::string> paths;
+        if (_layout.columns > 0)
+        {
+            paths.push_back(in_dir);
+        }
+        else
+        {
+            // Six face videos, named by the face in place of '%s'
+            size_t pattern = in_dir.find("%s");
+            int i;
+            for (i = 0; pattern != std::string::npos && i < 6; i++)
+            {
+                paths.push_back(in_dir.substr(0, pattern) + FrameIndex::FACE_NAMES[i] + in_dir.substr(pattern + 2));
+            }
+            if (paths.empty())
+            {
+                fail("video input needs a packed --layout, or '%%s' in its path to name six face videos");
+            }
+        }
+        PipeSource *source = new PipeSource();
+        if (!source->start(_options.decoder, paths, _layout))
+        {
+            fail("could not start decoder '%s'", _options.decoder.c_str());
+        }
+        _source = source;
+    }
+
+    // Index the input sequence once up front (a tar or zip archive is mapped and read in place)
+    struct stat input_info;
+    if (_source == NULL && stat(in_dir.c_str(), &input_info) == 0 && S_ISREG(input_info.st_mode))
+    {
+        _input_dir = in_dir;
+        if (!_archive.open(_input_dir))
+        {
+            fail("could not read '%s' as a tar or zip archive", _input_dir.c_str());
+        }
+        _frames.scanArchive(_archive, _input_dir, _layout.columns > 0);
+    }
+    else if (_source == NULL && _options.watch && !_frames.watch(_input_dir, _layout.columns > 0))
+    {
+        fail("could not watch directory '%s'", _input_dir.c_str());
+    }
+    else if (_source == NULL && !_options.watch && !_frames.scan(_input_dir, _layout.columns > 0))
+    {
+        fail("could not read directory '%s'", _input_dir.c_str());
+    }
+    if (_source == NULL && _frames.size() == 0 && !_options.watch)
+    {
+        fail("cubemap images not found in '%s'", _input_dir.c_str());
+    }
+
+    // Output format defaults to the format of the first frame (before selection, so all shards agree),
+    // or JPEG for frames that arrive decoded (or have yet to be written)
+    if (!stream && !ring_output && _output_format != "jpg" && _output_format != "png")
+    {
+        _output_format = (_source != NULL || _frames.size() == 0) ? "jpg" : _frames.at(0).faces[0].format;
+    }
+
+    // Restrict to the requested range and shard (which may be empty)
+    _range_frame_count = _frames.select(_options.frame_start, _options.frame_end, _options.frame_stride,
+                                        _options.shard_index, _options.shard_count);
+    _next_frame = 0;
 
-    _frame_count = 0;
-    snprintf(_frame_idx, 7, "%06d", _frame_count);
+    // Resumable and cached runs record each finished frame, and skip frames recorded with the same
+    // inputs and parameters
+    _params_hash = hashConversionParameters();
+    if ((_options.resume || _options.cache) && !_manifest.open(_output_dir + "frames.manifest"))
+    {
+        fail("could not open frame manifest in '%s'", _output_dir.c_str());
+    }
     
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        _face_sizes[i] = 0;
+        _face_bytes[i] = NULL;
+        _face_lengths[i] = 0;
+        _loaded_face_hashes[i] = 0;
+    }
+    _sample_count = 0;
+
+    _previous_texture = 0;
+    _previous_framebuffer = 0;
+    _upscale_texture = 0;
+    _upscale_framebuffer = 0;
+    _degrade_level = 0;
+    _max_degrade_level = (_options.pipeline == "fragment" || _options.pipeline == "mesh") ? 2 : 1;
+    _on_time_frames = 0;
+    _dropped_frames = 0;
+    _rendered_frames = 0;
+    _output_valid = false;
+
+    // Read upcoming frames' faces in the background
+    _prefetched_until = 0;
+    if (_options.prefetch_frames > 0 && _source == NULL)
+    {
+        if (!_prefetcher.start(_options.io_backend, _options.io_threads, _options.prefetch_budget))
+        {
+            fail("I/O backend '%s' is not available", _options.io_backend.c_str());
+        }
+    }
+
+    // Write outputs in the background, so conversion only waits when the write queue is full
+    if (!_writer.start(_options.io_backend, _options.io_threads, _options.write_budget, _options.sync_batch))
+    {
+        fail("I/O backend '%s' is not available", _options.io_backend.c_str());
+    }
+
+    std::vector<uint8_t> header;
+    if (_output_format == "y4m") iioEncodeY4mHeader(header, _output_width, _output_height, _options.framerate);
+    if (stream && !_writer.openStream(_options.output_fd, header))
+    {
+        fail("could not write to the output stream");
+    }
+
+    if (ring_output)
+    {
+        _output_ring = new ShmRing();
+        if (!_output_ring->create(makeShmName(out_dir.substr(4)), RING_IMAGE, _output_width, _output_height, _options.ring_slots))
+        {
+            fail("could not create shared memory ring '%s'", out_dir.substr(4).c_str());
+        }
+    }
+
+    // A '.tar' or '.pack' output path collects every frame in one container file
+    if (container && !_writer.openContainer(out_dir))
+    {
+        fail("could not create '%s'", out_dir.c_str());
+    }
+
     _vertex_position_attrib = 0;
     _vertex_texcoord_attrib = 1;
+    _output_buffer = 0;
+
+    // GL objects that only depend on the conversion parameters come from the caller's cache when
+    // given one (so they outlive this conversion), or from a private one
+    _cache = cache;
+    _owns_cache = (cache == NULL);
+    if (_owns_cache) _cache = new RenderCache();
     
     init();
 }
 
-Cube2Equirect::~Cube2Equirect()
+// Frees everything the conversion holds (anything not yet created is empty)
+void Cube2Equirect::release()
 {
+    if (_output_buffer != 0) glDeleteBuffers(1, &_output_buffer);
+    if (_previous_framebuffer != 0) glDeleteFramebuffers(1, &_previous_framebuffer);
+    if (_previous_texture != 0) glDeleteTextures(1, &_previous_texture);
+    if (_upscale_framebuffer != 0) glDeleteFramebuffers(1, &_upscale_framebuffer);
+    if (_upscale_texture != 0) glDeleteTextures(1, &_upscale_texture);
+    if (_owns_cache) delete _cache;
+    delete _source;
+    delete _output_ring;
     delete[] _output_pixels;
 }
 
 // Public
 bool Cube2Equirect::hasMoreFrames()
 {
-    bool more = false;
-    
-    std::string next_image = _input_dir + _frame_idx + "_left." + _input_format;
-    struct stat info;
-    if (stat(next_image.c_str(), &info) == 0 && !(info.st_mode & S_IFDIR)) {
-        more = true;
+    if (_source == NULL && (_next_frame < _frames.size() || !_options.watch))
+    {
+        return _next_frame < _frames.size();
+    }
+    if (_source == NULL)
+    {
+        // A watched directory has more frames until it goes idle or the sentinel appears
+        if (_frames.waitForFrames(_options.watch_idle_ms, _options.watch_sentinel))
+        {
+            return true;
+        }
+        finishOutput();
+        return false;
     }
 
-    return more;
+    // A stream cannot seek, so frames outside the selected range are read and dropped (stream
+    // positions serve as frame numbers)
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (_source_frame == NULL && _source->hasMoreFrames())
+    {
+        const SourceFrame& frame = _source->nextFrame();
+        if (_options.frame_end >= 0 && frame.number > _options.frame_end) break;
+        if (frame.number >= _options.frame_start && (frame.number - _options.frame_start) % _options.frame_stride == 0)
+        {
+            // Real-time mode drops a frame already past its deadline once a later one has arrived
+            if (_options.deadline_ms > 0 && frame.timestamp_ns != 0 && (timestampNs() - frame.timestamp_ns) / 1000000.0 > _options.deadline_ms &&
+                _source->isFrameWaiting())
+            {
+                _dropped_frames++;
+                continue;
+            }
+            _source_frame = &frame;
+        }
+    }
+    _source_wait_ms += elapsedMs(start);
+    if (_source_frame != NULL)
+    {
+        return true;
+    }
+
+    if (!_source->getError().empty())
+    {
+        fail("%s", _source->getError().c_str());
+    }
+    finishOutput();
+    return false;
 }
 
 void Cube2Equirect::renderNextFrame()
 {
-    glClear(GL_COLOR_BUFFER_BIT);
-    
-    // Update image textures
-    updateTextureFromImage(_input_dir + _frame_idx + "_left." + _input_format, _cube_textures[0]);
-    updateTextureFromImage(_input_dir + _frame_idx + "_right." + _input_format, _cube_textures[1]);
-    updateTextureFromImage(_input_dir + _frame_idx + "_bottom." + _input_format, _cube_textures[2]);
-    updateTextureFromImage(_input_dir + _frame_idx + "_top." + _input_format, _cube_textures[3]);
-    updateTextureFromImage(_input_dir + _frame_idx + "_back." + _input_format, _cube_textures[4]);
-    updateTextureFromImage(_input_dir + _frame_idx + "_front." + _input_format, _cube_textures[5]);
-    
-    // Render equirect image
+    if (_source != NULL)
+    {
+        renderSourceFrame(*_source_frame);
+        _source_frame = NULL;
+        _next_frame++;
+        recordWrittenFrames(false);
+        return;
+    }
+
+    const FrameEntry& frame = _frames.at(_next_frame);
+    prefetchFrames();
+    renderFrame(frame);
+
+    // Drop anything read ahead for this frame that turned out not to be needed
     int i;
-    GLint cube_uniforms[6];
-    cube_uniforms[0] = _uniforms["cube_left"];
-    cube_uniforms[1] = _uniforms["cube_right"];
-    cube_uniforms[2] = _uniforms["cube_bottom"];
-    cube_uniforms[3] = _uniforms["cube_top"];
-    cube_uniforms[4] = _uniforms["cube_back"];
-    cube_uniforms[5] = _uniforms["cube_front"];
     for (i = 0; i < 6; i++)
     {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_2D, _cube_textures[i]);
-        glUniform1i(cube_uniforms[i], i);
+        _prefetcher.discard(frame.faces[i].path);
     }
-    
-    glBindVertexArray(_vertex_array);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-    
-    // Save pixel buffer as image
-    glReadPixels(0, 0, _output_width, _output_height, GL_RGBA, GL_UNSIGNED_BYTE, _output_pixels);
-    if (_output_format == "jpg")
+    _next_frame++;
+
+    // Record frames whose outputs have been written (all of them after the last frame, which also
+    // completes the output; a watched directory's last frame is only known once it goes idle)
+    if (_next_frame >= _frames.size() && !_options.watch)
     {
-        iioWriteImageJpeg((_output_dir + "equirect_" + _frame_idx + ".jpg").c_str(), _output_width, _output_height, 4, 92, _output_pixels);
+        finishOutput();
     }
     else
     {
-        iioWriteImagePng((_output_dir + "equirect_" + _frame_idx + ".png").c_str(), _output_width, _output_height, 4, _output_pixels);
+        recordWrittenFrames(false);
     }
-    
-    
-    _frame_count++;
-    snprintf(_frame_idx, 7, "%06d", _frame_count);
 }
 
 std::string Cube2Equirect::getEquirectImageFormat()
@@ -90,7 +361,811 @@ std::string Cube2Equirect::getEquirectImageFormat()
     return _output_format;
 }
 
+size_t Cube2Equirect::getRangeFrameCount()
+{
+    return _range_frame_count;
+}
+
+const std::vector<std::string>& Cube2Equirect::getOutputFiles()
+{
+    return _output_files;
+}
+
+const C2EFrameStats& Cube2Equirect::getFrameStats()
+{
+    return _frame_stats;
+}
+
+PrefetchStats Cube2Equirect::getPrefetchStats()
+{
+    return _prefetcher.getStats();
+}
+
+const char* Cube2Equirect::getPrefetchBackend()
+{
+    return _prefetcher.getBackendName();
+}
+
+WriterStats Cube2Equirect::getWriterStats()
+{
+    return _writer.getStats();
+}
+
+const char* Cube2Equirect::getWriterBackend()
+{
+    return _writer.getBackendName();
+}
+
 // Private
+void Cube2Equirect::renderFrame(const FrameEntry& frame)
+{
+    _frame_stats = C2EFrameStats();
+    _frame_stats.frame = frame.number;
+    _frame_stats.reused_from = -1;
+    _frame_timestamp_ns = timestampNs();
+
+    // Only a fully rendered previous frame can be updated in place
+    bool output_valid = _output_valid;
+    _output_valid = false;
+
+    std::string output_name = makeOutputName(frame);
+    std::string output_path = _output_dir + output_name;
+    if ((_options.resume || _options.cache) && isFrameUpToDate(frame, output_name))
+    {
+        _frame_stats.skipped = true;
+        _output_files.push_back(output_path);
+        return;
+    }
+
+    // Read and hash face files, except those whose texture already holds the same file (same inode,
+    // size, and modification time, e.g. the previous frame's face or a hard link to it). Files with
+    // the same content as the loaded face are not decoded again either
+    int i;
+    uint64_t face_hash[6];
+    bool face_loaded[6];
+    int read_face = -1;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (i = 0; i < 6; i++)
+    {
+        const FaceFile& face = frame.faces[i];
+        const FaceFile& loaded = _loaded_faces[i];
+        face_loaded[i] = (_face_sizes[i] != 0 && isSameFile(face, loaded));
+        if (face_loaded[i])
+        {
+            face_hash[i] = _loaded_face_hashes[i];
+            continue;
+        }
+
+        // A packed image is read once, for the first face that needs it
+        if (read_face >= 0 && _layout.columns > 0)
+        {
+            _face_bytes[i] = _face_bytes[read_face];
+            _face_lengths[i] = _face_lengths[read_face];
+            face_hash[i] = face_hash[read_face];
+        }
+        else if (face.member >= 0)
+        {
+            if (!_archive.read(face.member, _face_data[i], &_face_bytes[i], &_face_lengths[i]))
+            {
+                fail("could not read image '%s'", face.path.c_str());
+            }
+        }
+        else
+        {
+            if (!_prefetcher.take(face.path, _face_data[i]) && !readFile(face.path, _face_data[i]))
+            {
+                fail("could not read image '%s'", face.path.c_str());
+            }
+            _face_bytes[i] = _face_data[i].data();
+            _face_lengths[i] = _face_data[i].size();
+        }
+        // Every face read is hashed (a packed image's faces share the first one's hash, above)
+        if (read_face < 0 || _layout.columns == 0)
+        {
+            face_hash[i] = xxh64(_face_bytes[i], _face_lengths[i], 0);
+            read_face = i;
+        }
+        face_loaded[i] = (_face_sizes[i] != 0 && face.size == loaded.size && face_hash[i] == _loaded_face_hashes[i]);
+        if (face_loaded[i])
+        {
+            _loaded_faces[i] = face;
+        }
+    }
+    _frame_stats.decode_ms += elapsedMs(start);
+
+    // Identical content (in this frame or another) reuses the earlier output, while partly changed
+    // content only re-renders the pixels fed by the changed faces
+    int face_mask = 0x3F;
+    if (_options.cache)
+    {
+        // An identical frame may still be waiting to be written and recorded
+        uint64_t content_key = FrameManifest::contentKey(_params_hash, face_hash);
+        std::deque<PendingRecord>::iterator pending;
+        for (pending = _pending_records.begin(); pending != _pending_records.end(); pending++)
+        {
+            if (FrameManifest::contentKey(_params_hash, pending->face_hash) == content_key)
+            {
+                recordWrittenFrames(true);
+                break;
+            }
+        }
+
+        const FrameRecord *same = _manifest.findContent(content_key);
+        if (same != NULL && isOutputValid(*same) && (same->number == frame.number || reuseOutput(*same, output_path)))
+        {
+            recordFrame(frame, output_name, face_hash);
+            _frame_stats.skipped = true;
+            _frame_stats.reused_from = same->number;
+            _output_files.push_back(output_path);
+            return;
+        }
+        face_mask = preparePartialFrame(frame, output_name, face_hash);
+    }
+
+    // Update image textures of the faces that will be sampled, unless they are already loaded
+    int refreshed_mask = 0;
+    for (i = 0; i < 6; i++)
+    {
+        if (!(face_mask & (1 << i))) continue;
+        _frame_stats.faces_rendered++;
+        if (!face_loaded[i])
+        {
+            if (_layout.columns == 0) updateTextureFromImage(frame.faces[i].path, i);
+            _loaded_faces[i] = frame.faces[i];
+            _loaded_face_hashes[i] = face_hash[i];
+            _frame_stats.faces_refreshed++;
+            refreshed_mask |= (1 << i);
+        }
+    }
+    if (_layout.columns > 0 && refreshed_mask != 0)
+    {
+        updateTexturesFromPackedImage(frame.faces[0].path, refreshed_mask);
+    }
+    int64_t write_sequence = convertFrame(face_mask, refreshed_mask, output_valid, output_path);
+
+    // The frame is recorded once its output exists
+    if (_options.resume || _options.cache)
+    {
+        PendingRecord pending;
+        pending.write_sequence = write_sequence;
+        pending.frame = frame;
+        pending.output_name = output_name;
+        memcpy(pending.face_hash, face_hash, sizeof(pending.face_hash));
+        _pending_records.push_back(pending);
+    }
+}
+
+// Renders the faces in `face_mask` (whose textures are up to date) into the output, then encodes it
+// and queues it to be written to `output_path`. Returns the write's sequence number
+int64_t Cube2Equirect::convertFrame(int face_mask, int refreshed_mask, bool output_valid, std::string output_path)
+{
+    int i;
+    std::chrono::steady_clock::time_point start;
+    _frame_stats.degrade_level = _degrade_level;
+    if (_options.pipeline == "remap" && _options.mipmaps && _degrade_level < 1)
+    {
+        std::chrono::steady_clock::time_point mip_start = std::chrono::steady_clock::now();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _cube_array);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        if (_options.stats) glFinish();
+        _frame_stats.upload_ms += elapsedMs(mip_start);
+    }
+    
+    // Sample count only depends on the face and output resolutions (once all faces have been seen)
+    if (_sample_count == 0 && std::find(_face_sizes, _face_sizes + 6, 0) == _face_sizes + 6)
+    {
+        int max_samples = (_options.pipeline == "remap" || _options.pipeline == "mesh") ? 1 : _options.antialias;
+        _sample_count = eqmap::countAdaptiveSamples(_output_width, _output_height, _face_sizes, max_samples);
+    }
+    _frame_stats.samples = _sample_count;
+
+    // Render equirect image
+    if (_options.pipeline == "remap")
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, _remap_texture);
+        glUniform1i(uniformLocation("remap"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _cube_array);
+        glUniform1i(uniformLocation("cube_faces"), 1);
+        glUniform1f(uniformLocation("face_lod_bias"), log2((double)_face_sizes[0]));
+        glUniform1i(uniformLocation("face_mask"), face_mask);
+    }
+    else if (_options.pipeline != "mesh")
+    {
+        GLint cube_uniforms[6];
+        cube_uniforms[0] = uniformLocation("cube_left");
+        cube_uniforms[1] = uniformLocation("cube_right");
+        cube_uniforms[2] = uniformLocation("cube_bottom");
+        cube_uniforms[3] = uniformLocation("cube_top");
+        cube_uniforms[4] = uniformLocation("cube_back");
+        cube_uniforms[5] = uniformLocation("cube_front");
+        for (i = 0; i < 6; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, _cube_textures[i]);
+            glUniform1i(cube_uniforms[i], i);
+        }
+        glUniform1i(uniformLocation("face_mask"), face_mask);
+    }
+    
+    // Dirty-region mode keeps the previous frame's output and only re-renders the regions fed by the
+    // faces that were refreshed (all textures are current, so the regions can be redrawn in full)
+    std::vector<const int*> regions;
+    int full_frame[4] = {0, 0, _output_width, _output_height};
+    bool reduced = (_degrade_level >= 2 && face_mask == 0x3F);
+    if (_options.dirty && output_valid && face_mask == 0x3F && !reduced)
+    {
+        for (i = 0; i < 6; i++)
+        {
+            if (refreshed_mask & (1 << i)) regions.push_back(_face_regions[i]);
+        }
+        _frame_stats.dirty_regions = (int)regions.size();
+    }
+    else
+    {
+        regions.push_back(full_frame);
+        _frame_stats.dirty_regions = -1;
+    }
+
+    // Partial frames keep the previous output (already loaded) outside the changed faces
+    start = std::chrono::steady_clock::now();
+    size_t r;
+    if (reduced)
+    {
+        renderReducedFrame();
+    }
+    for (r = 0; r < regions.size() && !reduced; r++)
+    {
+        renderRegion(regions[r], face_mask, regions[r] == full_frame);
+    }
+    if (_options.stats) glFinish();
+    _frame_stats.convert_ms = elapsedMs(start);
+    
+    // Save pixel buffer as image
+    start = std::chrono::steady_clock::now();
+    if (_options.pipeline == "compute")
+    {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+    if (reduced)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _upscale_framebuffer);
+    }
+    for (r = 0; r < regions.size(); r++)
+    {
+        readRegion(regions[r]);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    _frame_stats.readback_ms = elapsedMs(start);
+    _output_valid = (face_mask == 0x3F && !reduced);
+
+    // A ring output takes the pixels as they are (once the consumer has freed a slot)
+    start = std::chrono::steady_clock::now();
+    int64_t write_sequence = -1;
+    if (_output_ring != NULL)
+    {
+        uint8_t *slot = _output_ring->acquireWrite();
+        if (slot == NULL)
+        {
+            fail("the consumer of the shared memory ring stopped reading");
+        }
+        memcpy(slot, _output_pixels, (size_t)_output_width * _output_height * 4);
+        _output_ring->publish(_frame_stats.frame, _frame_timestamp_ns);
+    }
+    else
+    {
+        // Encode to memory and queue the file to be written in the background (to a temporary file that
+        // is renamed into place, so an interrupted run never leaves a truncated image behind)
+        int encoded;
+        if (_output_format == "jpg")
+        {
+            encoded = iioEncodeImageJpeg(_encoded, _output_width, _output_height, 4, 92, _output_pixels);
+        }
+        else if (_output_format == "raw")
+        {
+            _encoded.assign(_output_pixels, _output_pixels + (size_t)_output_width * _output_height * 4);
+            encoded = 1;
+        }
+        else if (_output_format == "y4m")
+        {
+            encoded = iioEncodeY4mFrame(_encoded, _output_width, _output_height, 4, _output_pixels);
+        }
+        else
+        {
+            encoded = iioEncodeImagePng(_encoded, _output_width, _output_height, 4, _output_pixels);
+        }
+        if (!encoded)
+        {
+            fail("could not encode '%s'", output_path.c_str());
+        }
+        write_sequence = _writer.write(output_path, _encoded);
+    }
+    _output_files.push_back(output_path);
+    _frame_stats.encode_ms = elapsedMs(start);
+    _frame_stats.latency_ms = (timestampNs() - _frame_timestamp_ns) / 1000000.0;
+    if (_options.deadline_ms > 0)
+    {
+        updateDegradeLevel(_frame_stats.latency_ms);
+    }
+
+    // Quality against a supersampled reference on sampled frames, so filtering can be weighed against
+    // its cost (after the output is queued, so it is outside every stage time and the latency)
+    if (_options.psnr_interval > 0 && _options.deadline_ms <= 0.0 && _rendered_frames % _options.psnr_interval == 0 &&
+        std::find(_face_sizes, _face_sizes + 6, 0) == _face_sizes + 6)
+    {
+        _frame_stats.psnr_db = measureQuality();
+    }
+    _rendered_frames++;
+    return write_sequence;
+}
+
+// Uploads a decoded frame's faces straight from the source's pixels, and converts it
+void Cube2Equirect::renderSourceFrame(const SourceFrame& frame)
+{
+    _frame_stats = C2EFrameStats();
+    _frame_stats.frame = frame.number;
+    _frame_stats.reused_from = -1;
+    _frame_stats.decode_ms = _source_wait_ms;
+    _frame_stats.dropped_frames = _dropped_frames;
+    _source_wait_ms = 0.0;
+    _dropped_frames = 0;
+    _frame_timestamp_ns = (frame.timestamp_ns != 0) ? frame.timestamp_ns : timestampNs();
+    bool output_valid = _output_valid;
+    _output_valid = false;
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, frame.row_length);
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        uploadFace(_input_dir, i, (uint8_t*)frame.faces[i], frame.width[i], frame.height[i]);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    _frame_stats.faces_rendered = 6;
+    _frame_stats.faces_refreshed = 6;
+
+    char output_name[32];
+    snprintf(output_name, 32, "equirect_%06d.%s", frame.number, _output_format.c_str());
+    convertFrame(0x3F, 0x3F, output_valid, _output_dir + output_name);
+}
+
+// Queues the faces of the frames in the read-ahead window, except for frames that will be skipped
+// and faces that are the same file as the previous frame's (which stay loaded)
+void Cube2Equirect::prefetchFrames()
+{
+    if (_options.prefetch_frames <= 0)
+    {
+        return;
+    }
+
+    size_t end = std::min(_next_frame + 1 + _options.prefetch_frames, _frames.size());
+    for (_prefetched_until = std::max(_prefetched_until, _next_frame); _prefetched_until < end; _prefetched_until++)
+    {
+        const FrameEntry& frame = _frames.at(_prefetched_until);
+        if ((_options.resume || _options.cache) && isFrameUpToDate(frame, makeOutputName(frame)))
+        {
+            continue;
+        }
+        // A packed frame is one file shared by all of its faces
+        int i;
+        for (i = 0; i < (_layout.columns > 0 ? 1 : 6); i++)
+        {
+            if (_prefetched_until > 0 && isSameFile(frame.faces[i], _frames.at(_prefetched_until - 1).faces[i])) continue;
+            if (frame.faces[i].member >= 0) _archive.willNeed(frame.faces[i].member);
+            else _prefetcher.request(frame.faces[i].path, frame.faces[i].size);
+        }
+    }
+}
+
+// Renders the output pixels within `rect` (x, y, width, height, with row 0 at the bottom), sampling
+// only the faces in `face_mask`
+void Cube2Equirect::renderRegion(const int rect[4], int face_mask, bool clear)
+{
+    if (_options.pipeline == "compute")
+    {
+        // Workgroups past the region's edge re-render a few extra (still valid) pixels
+        GLuint groups_x = (rect[2] + _options.workgroup_size[0] - 1) / _options.workgroup_size[0];
+        GLuint groups_y = (rect[3] + _options.workgroup_size[1] - 1) / _options.workgroup_size[1];
+        glUniform2i(uniformLocation("pixel_offset"), rect[0], rect[1]);
+        glDispatchCompute(groups_x, groups_y, 1);
+        return;
+    }
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(rect[0], rect[1], rect[2], rect[3]);
+    if (clear && face_mask == 0x3F) glClear(GL_COLOR_BUFFER_BIT);
+    glBindVertexArray(_vertex_array);
+    if (_options.pipeline == "mesh")
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(uniformLocation("cube_face"), 0);
+        int i;
+        for (i = 0; i < 6; i++)
+        {
+            if (!(face_mask & (1 << i))) continue;
+            glBindTexture(GL_TEXTURE_2D, _cube_textures[i]);
+            glDrawArrays(GL_TRIANGLES, _mesh_first[i], _mesh_count[i]);
+        }
+    }
+    else
+    {
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    }
+    glDisable(GL_SCISSOR_TEST);
+}
+
+// Renders the whole frame at half resolution, then scales it up into the output size framebuffer that
+// it is read back from (real-time mode, when behind)
+void Cube2Equirect::renderReducedFrame()
+{
+    int rect[4] = {0, 0, _output_width / 2, _output_height / 2};
+    glViewport(0, 0, rect[2], rect[3]);
+    glUniform2f(uniformLocation("output_size"), rect[2], rect[3]);
+    renderRegion(rect, 0x3F, true);
+    glViewport(0, 0, _output_width, _output_height);
+    glUniform2f(uniformLocation("output_size"), _output_width, _output_height);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _upscale_framebuffer);
+    glBlitFramebuffer(0, 0, rect[2], rect[3], 0, 0, _output_width, _output_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+// Copies the output pixels within `rect` back into the output image
+void Cube2Equirect::readRegion(const int rect[4])
+{
+    if (_options.pipeline == "compute")
+    {
+        // Storage buffer is already in the encoder's layout, so whole rows are copied out as is
+        GLintptr offset = (GLintptr)rect[1] * _output_width * 4;
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, (GLsizeiptr)rect[3] * _output_width * 4, _output_pixels + offset);
+    }
+    else
+    {
+        glPixelStorei(GL_PACK_ROW_LENGTH, _output_width);
+        glReadPixels(rect[0], rect[1], rect[2], rect[3], GL_RGBA, GL_UNSIGNED_BYTE,
+                     _output_pixels + ((size_t)rect[1] * _output_width + rect[0]) * 4);
+        glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    }
+}
+
+// Reads the faces back from their textures and compares the output with a 4x4 supersampled CPU
+// reference (on a grid of about 1024 pixels across, to bound the cost)
+double Cube2Equirect::measureQuality()
+{
+    int i;
+    std::vector<uint8_t> face_pixels[6];
+    const uint8_t *faces[6];
+    if (_options.pipeline == "remap")
+    {
+        std::vector<uint8_t> layers((size_t)_face_sizes[0] * _face_sizes[0] * 4 * 6);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _cube_array);
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, layers.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        for (i = 0; i < 6; i++)
+        {
+            size_t face_bytes = (size_t)_face_sizes[0] * _face_sizes[0] * 4;
+            face_pixels[i].assign(layers.begin() + face_bytes * i, layers.begin() + face_bytes * (i + 1));
+        }
+    }
+    else
+    {
+        for (i = 0; i < 6; i++)
+        {
+            face_pixels[i].resize((size_t)_face_sizes[i] * _face_sizes[i] * 4);
+            glBindTexture(GL_TEXTURE_2D, _cube_textures[i]);
+            glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, face_pixels[i].data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    for (i = 0; i < 6; i++)
+    {
+        faces[i] = face_pixels[i].data();
+    }
+    int step = std::max(1, _output_width / 1024);
+    return eqmap::supersampledPsnr(_output_pixels, _output_width, _output_height, faces, _face_sizes, step, 4);
+}
+
+bool Cube2Equirect::isFrameUpToDate(const FrameEntry& frame, std::string output_name)
+{
+    const FrameRecord *record = _manifest.find(frame.number);
+    if (record == NULL || record->params_hash != _params_hash || record->output != output_name)
+    {
+        return false;
+    }
+
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        if (record->face_size[i] != frame.faces[i].size || record->face_mtime_ns[i] != frame.faces[i].mtime_ns)
+        {
+            return false;
+        }
+    }
+
+    return isOutputValid(*record);
+}
+
+// Whether the output a record refers to is still the file that was recorded
+bool Cube2Equirect::isOutputValid(const FrameRecord& record)
+{
+    struct stat info;
+    return stat((_output_dir + record.output).c_str(), &info) == 0 && info.st_size == record.output_size &&
+           (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec == record.output_mtime_ns;
+}
+
+// Places a copy of the output of an identical frame at `output_path` (a hard link when possible)
+bool Cube2Equirect::reuseOutput(const FrameRecord& record, std::string output_path)
+{
+    char tmp_suffix[32];
+    snprintf(tmp_suffix, 32, ".%d.tmp", (int)getpid());
+    std::string tmp_path = output_path + tmp_suffix;
+    std::string source_path = _output_dir + record.output;
+    if (link(source_path.c_str(), tmp_path.c_str()) != 0)
+    {
+        std::vector<uint8_t> data;
+        FILE *fp = readFile(source_path, data) ? fopen(tmp_path.c_str(), "wb") : NULL;
+        if (fp == NULL)
+        {
+            return false;
+        }
+        bool ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+        ok = (fclose(fp) == 0) && ok;
+        if (!ok)
+        {
+            remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp_path.c_str(), output_path.c_str()) != 0)
+    {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Finds which faces changed since this frame's recorded (lossless) output was made, and loads that
+// output as the starting point for rendering only those faces. Returns a mask of faces to render
+// (all six if the frame has to be rendered in full)
+int Cube2Equirect::preparePartialFrame(const FrameEntry& frame, std::string output_name, const uint64_t face_hash[6])
+{
+    // With a single sample per pixel, each output pixel depends on exactly one face, so faces that
+    // are not re-decoded are never sampled (the remap pipeline's face array must already exist)
+    if (_options.antialias > 1 || _output_format != "png" || (_options.pipeline == "remap" && _face_sizes[0] == 0))
+    {
+        return 0x3F;
+    }
+    const FrameRecord *record = _manifest.find(frame.number);
+    if (record == NULL || record->params_hash != _params_hash || record->output != output_name || !isOutputValid(*record))
+    {
+        return 0x3F;
+    }
+    int face_mask = 0;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        if (record->face_hash[i] == 0) return 0x3F;
+        if (record->face_hash[i] != face_hash[i]) face_mask |= (1 << i);
+    }
+
+    int width, height;
+    int channels = 4;
+    uint8_t *previous = iioReadImage((_output_dir + output_name).c_str(), &width, &height, &channels);
+    if (previous == NULL || width != _output_width || height != _output_height)
+    {
+        if (previous != NULL) iioFreeImage(previous);
+        return 0x3F;
+    }
+
+    // The encoded image's first row is the first row read back, so it is uploaded as is
+    if (_options.pipeline == "compute")
+    {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, _output_width * _output_height * 4, previous);
+    }
+    else
+    {
+        if (_previous_texture == 0)
+        {
+            glGenTextures(1, &_previous_texture);
+            glBindTexture(GL_TEXTURE_2D, _previous_texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _output_width, _output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            glGenFramebuffers(1, &_previous_framebuffer);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, _previous_framebuffer);
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _previous_texture, 0);
+        }
+        glBindTexture(GL_TEXTURE_2D, _previous_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _output_width, _output_height, GL_RGBA, GL_UNSIGNED_BYTE, previous);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, _previous_framebuffer);
+        glBlitFramebuffer(0, 0, _output_width, _output_height, 0, 0, _output_width, _output_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    }
+    iioFreeImage(previous);
+
+    return face_mask;
+}
+
+void Cube2Equirect::recordFrame(const FrameEntry& frame, std::string output_name, const uint64_t face_hash[6])
+{
+    struct stat info;
+    if (stat((_output_dir + output_name).c_str(), &info) != 0)
+    {
+        return;
+    }
+
+    FrameRecord record;
+    record.number = frame.number;
+    record.params_hash = _params_hash;
+    record.output = output_name;
+    record.output_size = info.st_size;
+    record.output_mtime_ns = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        record.face_size[i] = frame.faces[i].size;
+        record.face_mtime_ns[i] = frame.faces[i].mtime_ns;
+        record.face_hash[i] = face_hash[i];
+    }
+    if (!_manifest.append(record))
+    {
+        fprintf(stderr, "Warning: could not record frame %06d in the frame manifest\n", frame.number);
+    }
+}
+
+// Records the frames whose outputs the writer has finished (after waiting for all of them, if
+// `wait`), failing if any output could not be written
+void Cube2Equirect::recordWrittenFrames(bool wait)
+{
+    if (wait)
+    {
+        _writer.flush();
+    }
+    std::string failed_path = _writer.getFailedPath();
+    if (!failed_path.empty())
+    {
+        fail("could not write '%s'", failed_path.c_str());
+    }
+
+    int64_t finished = _writer.getFinishedCount();
+    while (!_pending_records.empty() && _pending_records.front().write_sequence < finished)
+    {
+        const PendingRecord& pending = _pending_records.front();
+        recordFrame(pending.frame, pending.output_name, pending.face_hash);
+        _pending_records.pop_front();
+    }
+}
+
+// Real-time mode: steps down to cheaper rendering after a frame misses the deadline, and back up after
+// a run of frames well within it. Level 1 takes one sample per pixel without mip chains, and level 2
+// also renders at half resolution (fragment and mesh pipelines)
+void Cube2Equirect::updateDegradeLevel(double latency_ms)
+{
+    if (latency_ms > _options.deadline_ms)
+    {
+        _on_time_frames = 0;
+        if (_degrade_level < _max_degrade_level) setDegradeLevel(_degrade_level + 1);
+    }
+    else if (latency_ms < _options.deadline_ms / 2.0 && _degrade_level > 0)
+    {
+        if (++_on_time_frames >= 30)
+        {
+            _on_time_frames = 0;
+            setDegradeLevel(_degrade_level - 1);
+        }
+    }
+    else
+    {
+        _on_time_frames = 0;
+    }
+}
+
+void Cube2Equirect::setDegradeLevel(int level)
+{
+    bool filtered = (level < 1);
+    glUniform1i(uniformLocation("max_samples"), filtered ? _options.antialias : 1);
+
+    // Mip chains are rebuilt when filtering is restored, as faces that did not change since are not uploaded again
+    if (_options.mipmaps)
+    {
+        GLenum min_filter = filtered ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+        if (_options.pipeline == "remap")
+        {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, _cube_array);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min_filter);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+        else
+        {
+            int i;
+            for (i = 0; i < 6; i++)
+            {
+                glBindTexture(GL_TEXTURE_2D, _cube_textures[i]);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+                if (filtered && _face_sizes[i] > 0) glGenerateMipmap(GL_TEXTURE_2D);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    }
+
+    if (level >= 2 && _upscale_framebuffer == 0)
+    {
+        glGenTextures(1, &_upscale_texture);
+        glBindTexture(GL_TEXTURE_2D, _upscale_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _output_width, _output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glGenFramebuffers(1, &_upscale_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, _upscale_framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _upscale_texture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    _degrade_level = level;
+}
+
+// Completes the output after the last frame: waits for every write (recording the frames), then finishes
+// the container, or closes the ring once its consumer has taken every frame
+void Cube2Equirect::finishOutput()
+{
+    recordWrittenFrames(true);
+    if (!_writer.finishContainer())
+    {
+        fail("could not finish writing the output container");
+    }
+    if (_output_ring != NULL)
+    {
+        _output_ring->close();
+        if (!_output_ring->drain())
+        {
+            fprintf(stderr, "Warning: the consumer of the shared memory ring did not take every frame\n");
+        }
+    }
+}
+
+// FNV-1a hash of every option that affects the output pixels
+uint64_t Cube2Equirect::hashConversionParameters()
+{
+    char params[256];
+    snprintf(params, 256, "%dx%d %s %s %d %d %d %d %s", _output_width, _output_height, _output_format.c_str(), _options.pipeline.c_str(),
+             _options.mesh_density, (int)_options.scaled_decode, (int)_options.mipmaps, _options.antialias, _options.layout.c_str());
+
+    uint64_t hash = 14695981039346656037ULL;
+    const char *c;
+    for (c = params; *c != '\0'; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string Cube2Equirect::makeOutputName(const FrameEntry& frame)
+{
+    char output_name[32];
+    snprintf(output_name, 32, "equirect_%06d.%s", frame.number, _output_format.c_str());
+    return output_name;
+}
+
+// Whether two face files are the same file, unmodified (hard links included, in archives too)
+bool Cube2Equirect::isSameFile(const FaceFile& a, const FaceFile& b)
+{
+    return a.device == b.device && a.inode == b.inode && a.member == b.member && a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+bool Cube2Equirect::readFile(std::string filename, std::vector<uint8_t>& data)
+{
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == NULL)
+    {
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data.resize(size > 0 ? size : 0);
+    bool ok = (size >= 0 && fread(data.data(), 1, data.size(), fp) == data.size());
+    fclose(fp);
+    return ok;
+}
+
 std::string Cube2Equirect::makePath(std::string path)
 {
     if (path[path.length() - 1] != '/')
@@ -100,42 +1175,190 @@ std::string Cube2Equirect::makePath(std::string path)
     return path;
 }
 
-void Cube2Equirect::init()
+double Cube2Equirect::elapsedMs(std::chrono::steady_clock::time_point start)
 {
-    _program = glsl::createShaderProgram("shaders/cube2equirect.vert", "shaders/cube2equirect.frag");
-    
-    // Specify input and output attributes for the GPU program
-    glBindAttribLocation(_program, _vertex_position_attrib, "vertex_position");
-    glBindAttribLocation(_program, _vertex_texcoord_attrib, "vertex_texcoord");
-    glBindFragDataLocation(_program, 0, "FragColor");
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
 
-    // Link compiled GPU program
-    glsl::linkShaderProgram(_program);
+// CLOCK_MONOTONIC time (the steady clock), which other processes stamp shared memory frames with
+int64_t Cube2Equirect::timestampNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-    // Get handles to uniform variables defined in the shaders
-    glsl::getShaderProgramUniforms(_program, _uniforms);
+// Ends the conversion: throws C2EError with the formatted message
+void Cube2Equirect::fail(const char *format, ...)
+{
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    throw C2EError(message);
+}
+
+// Shared memory object names start with a '/'
+std::string Cube2Equirect::makeShmName(std::string name)
+{
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+// Location of a uniform of the current program, or -1 (which glUniform*() ignores) if the program does
+// not use it
+GLint Cube2Equirect::uniformLocation(const char *name)
+{
+    std::map<std::string,GLint>::const_iterator it = _uniforms.find(name);
+    return (it != _uniforms.end()) ? it->second : -1;
+}
+
+void Cube2Equirect::init()
+{
+    std::string defines = "";
+    if (_options.antialias > 1) defines += "#define ADAPTIVE_ANTIALIAS\n";
+
+    if (_options.pipeline == "compute")
+    {
+        if (!gl43LoadCompute())
+        {
+            fail("compute pipeline requires OpenGL 4.3");
+        }
+        GLint max_invocations, max_size[2];
+        glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max_size[0]);
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &max_size[1]);
+        if (_options.workgroup_size[0] > max_size[0] || _options.workgroup_size[1] > max_size[1] ||
+            (int64_t)_options.workgroup_size[0] * _options.workgroup_size[1] > max_invocations)
+        {
+            fail("workgroup size %dx%d is beyond this GPU's limits (at most %dx%d, and %d invocations)",
+                    _options.workgroup_size[0], _options.workgroup_size[1], max_size[0], max_size[1], max_invocations);
+        }
+
+        char workgroup_defines[96];
+        snprintf(workgroup_defines, 96, "#define WORKGROUP_SIZE_X %d\n#define WORKGROUP_SIZE_Y %d\n", _options.workgroup_size[0], _options.workgroup_size[1]);
+        defines += workgroup_defines;
+        RenderCache::Program *program = _cache->findProgram(_options.pipeline + "\n" + defines);
+        if (program == NULL)
+        {
+            RenderCache::Program compiled;
+            compiled.program = glsl::createComputeShaderProgram("shaders/cube2equirect.comp", defines.c_str(), "shaders/cubemapping.glsl");
+
+            // Link compiled GPU program
+            if (!glsl::linkShaderProgram(compiled.program))
+            {
+                glDeleteProgram(compiled.program);
+                fail("could not build the %s pipeline's shaders", _options.pipeline.c_str());
+            }
+
+            // Get handles to uniform variables defined in the shaders
+            glsl::getShaderProgramUniforms(compiled.program, compiled.uniforms);
+            program = _cache->addProgram(_options.pipeline + "\n" + defines, compiled);
+        }
+        _program = program->program;
+        _uniforms = program->uniforms;
+
+        // Create storage buffer the compute shader writes output pixels to
+        glGenBuffers(1, &_output_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, _output_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, _output_width * _output_height * 4, NULL, GL_STREAM_READ);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _output_buffer);
+    }
+    else
+    {
+        // Only the fragment pipeline's shader takes defines
+        std::string program_key = _options.pipeline + "\n" + ((_options.pipeline == "fragment") ? defines : "");
+        RenderCache::Program *program = _cache->findProgram(program_key);
+        if (program == NULL)
+        {
+            RenderCache::Program compiled;
+            if (_options.pipeline == "remap")
+            {
+                compiled.program = glsl::createShaderProgram("shaders/cube2equirect.vert", "shaders/cube2equirect_remap.frag");
+            }
+            else if (_options.pipeline == "mesh")
+            {
+                compiled.program = glsl::createShaderProgram("shaders/cube2equirect.vert", "shaders/cube2equirect_mesh.frag");
+            }
+            else
+            {
+                compiled.program = glsl::createShaderProgram("shaders/cube2equirect.vert", "shaders/cube2equirect.frag", defines.c_str(), "shaders/cubemapping.glsl");
+            }
     
-    // Set background color
-    glClearColor(1.0, 1.0, 1.0, 1.0);
+            // Specify input and output attributes for the GPU program
+            glBindAttribLocation(compiled.program, _vertex_position_attrib, "vertex_position");
+            glBindAttribLocation(compiled.program, _vertex_texcoord_attrib, "vertex_texcoord");
+            glBindFragDataLocation(compiled.program, 0, "FragColor");
+
+            // Link compiled GPU program
+            if (!glsl::linkShaderProgram(compiled.program))
+            {
+                glDeleteProgram(compiled.program);
+                fail("could not build the %s pipeline's shaders", _options.pipeline.c_str());
+            }
+
+            // Get handles to uniform variables defined in the shaders
+            glsl::getShaderProgramUniforms(compiled.program, compiled.uniforms);
+            program = _cache->addProgram(program_key, compiled);
+        }
+        _program = program->program;
+        _uniforms = program->uniforms;
+
+        // Set background color
+        glClearColor(1.0, 1.0, 1.0, 1.0);
     
-    // Create fullscreen quad
-    createVertexArrayObject();
+        // Create fullscreen quad (or tessellated cube faces)
+        int mesh_density = (_options.pipeline == "mesh") ? _options.mesh_density : 0;
+        RenderCache::Geometry *geometry = _cache->findGeometry(mesh_density);
+        if (geometry == NULL)
+        {
+            RenderCache::Geometry created;
+            if (_options.pipeline == "mesh")
+            {
+                createFaceMeshVertexArrayObject(&created);
+            }
+            else
+            {
+                createVertexArrayObject(&created);
+            }
+            geometry = _cache->addGeometry(mesh_density, created);
+        }
+        _vertex_array = geometry->vertex_array;
+        std::copy(geometry->first, geometry->first + 6, _mesh_first);
+        std::copy(geometry->count, geometry->count + 6, _mesh_count);
+    }
     
     // Create cubemap textures
     createCubemapTextures();
+
+    // Precompute the equirect to cube face mapping
+    if (_options.pipeline == "remap")
+    {
+        createRemapTexture();
+    }
+
+    // Precompute the output region fed by each face
+    if (_options.dirty)
+    {
+        eqmap::faceCoverage(_output_width, _output_height, _face_regions);
+    }
     
+    // A reused context may last have rendered at another size
+    glViewport(0, 0, _output_width, _output_height);
     glUseProgram(_program);
+    glUniform2f(uniformLocation("output_size"), _output_width, _output_height);
+    glUniform1i(uniformLocation("max_samples"), _options.antialias);
 }
 
-void Cube2Equirect::createVertexArrayObject()
+void Cube2Equirect::createVertexArrayObject(RenderCache::Geometry *geometry)
 {
-    glGenVertexArrays(1, &_vertex_array);
-    glBindVertexArray(_vertex_array);
+    glGenVertexArrays(1, &geometry->vertex_array);
+    glBindVertexArray(geometry->vertex_array);
+    glGenBuffers(3, geometry->buffers);
+    std::fill(geometry->first, geometry->first + 6, 0);
+    std::fill(geometry->count, geometry->count + 6, 0);
     
     // Vertices
-    GLuint vertex_position_buffer;
-    glGenBuffers(1, &vertex_position_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_position_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[0]);
     GLfloat vertices[] = {
         -1.0, -1.0, -1.0,  // left,  bottom, back
         -1.0,  1.0, -1.0,  // left,  top,    back
@@ -147,9 +1370,7 @@ void Cube2Equirect::createVertexArrayObject()
     glVertexAttribPointer(_vertex_position_attrib, 3, GL_FLOAT, false, 0, 0);
     
     // Texture Coordinates
-    GLuint vertex_texcoord_buffer;
-    glGenBuffers(1, &vertex_texcoord_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_texcoord_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[1]);
     GLfloat texcoords[] = {
         -1.0, -1.0,  // left,  bottom
         -1.0,  1.0,  // left,  top
@@ -161,9 +1382,7 @@ void Cube2Equirect::createVertexArrayObject()
     glVertexAttribPointer(_vertex_texcoord_attrib, 2, GL_FLOAT, false, 0, 0);
     
     // Faces of triangles
-    GLuint vertex_index_buffer;
-    glGenBuffers(1, &vertex_index_buffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vertex_index_buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry->buffers[2]);
     GLushort vertex_indices[] = {
          0, 3, 1,
          3, 0, 2
@@ -176,57 +1395,233 @@ void Cube2Equirect::createVertexArrayObject()
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+void Cube2Equirect::createFaceMeshVertexArrayObject(RenderCache::Geometry *geometry)
+{
+    glGenVertexArrays(1, &geometry->vertex_array);
+    glBindVertexArray(geometry->vertex_array);
+    glGenBuffers(2, geometry->buffers);
+    geometry->buffers[2] = 0;
+
+    // Tessellate each face, keeping track of where its triangles start in the shared buffers
+    int i;
+    std::vector<float> vertices;
+    std::vector<float> texcoords;
+    for (i = 0; i < 6; i++)
+    {
+        geometry->first[i] = vertices.size() / 3;
+        eqmap::buildFaceMesh(i, _options.mesh_density, vertices, texcoords);
+        geometry->count[i] = vertices.size() / 3 - geometry->first[i];
+    }
+
+    // Vertices
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(_vertex_position_attrib);
+    glVertexAttribPointer(_vertex_position_attrib, 3, GL_FLOAT, false, 0, 0);
+
+    // Texture Coordinates
+    glBindBuffer(GL_ARRAY_BUFFER, geometry->buffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, texcoords.size() * sizeof(GLfloat), texcoords.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(_vertex_texcoord_attrib);
+    glVertexAttribPointer(_vertex_texcoord_attrib, 2, GL_FLOAT, false, 0, 0);
+
+    // Unbind data
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 void Cube2Equirect::createCubemapTextures()
 {
+    // Textures kept from an earlier conversion get their filtering set again, and are resized by the
+    // first upload (every face size starts at 0)
     int i;
-    glGenTextures(6, _cube_textures);
+    for (i = 0; i < 6; i++)
+    {
+        std::string key = "face" + std::to_string(i);
+        _cube_textures[i] = _cache->findTexture(key);
+        if (_cube_textures[i] == 0)
+        {
+            glGenTextures(1, &_cube_textures[i]);
+            _cache->addTexture(key, _cube_textures[i]);
+        }
+    }
     glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    if (_options.pipeline == "remap")
+    {
+        // Remap pipeline selects faces by layer index, so all six share one array texture
+        _cube_array = _cache->findTexture("faces");
+        if (_cube_array == 0)
+        {
+            glGenTextures(1, &_cube_array);
+            _cache->addTexture("faces", _cube_array);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _cube_array);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, _options.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
     for (i = 0; i < 6; i++)
     {
         glBindTexture(GL_TEXTURE_2D, _cube_textures[i]);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, _options.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
     
-    struct stat info;
-    if (stat((_input_dir + "000000_left.jpg").c_str(), &info) == 0 && !(info.st_mode & S_IFDIR))
-    {
-        _input_format = "jpg";
-        if (_output_format != "jpg" && _output_format != "png") _output_format = "jpg";
-    }
-    else if (stat((_input_dir + "000000_left.png").c_str(), &info) == 0 && !(info.st_mode & S_IFDIR))
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Cube2Equirect::createRemapTexture()
+{
+    std::string key = "remap " + std::to_string(_output_width) + "x" + std::to_string(_output_height);
+    _remap_texture = _cache->findTexture(key);
+    if (_remap_texture != 0)
     {
-        _input_format = "png";
-        if (_output_format != "jpg" && _output_format != "png") _output_format = "png";
+        return;
     }
-    else
+
+    // Each texel holds the face coordinate (RG), face index / 5 (B), and the size of the pixel's
+    // footprint on the face as -log2(footprint) / 32 (A), from which the shader derives the mip level
+    int x, y;
+    uint16_t *remap = new uint16_t[_output_width * _output_height * 4];
+    eqmap::FaceCoord fc;
+    for (y = 0; y < _output_height; y++)
     {
-        fprintf(stderr, "Cubemap images not found in directory '%s'\n", _input_dir.c_str());
-        exit(EXIT_FAILURE);
+        for (x = 0; x < _output_width; x++)
+        {
+            eqmap::mapPixel(x, y, _output_width, _output_height, &fc);
+            double len_dx = sqrt(fc.dpx_dx[0] * fc.dpx_dx[0] + fc.dpx_dx[1] * fc.dpx_dx[1]);
+            double len_dy = sqrt(fc.dpx_dy[0] * fc.dpx_dy[0] + fc.dpx_dy[1] * fc.dpx_dy[1]);
+            double footprint_log2 = -log2(std::max(len_dx, len_dy)) / 32.0;
+
+            uint16_t *texel = remap + (y * _output_width + x) * 4;
+            texel[0] = (uint16_t)lround(std::max(0.0, std::min(fc.px[0], 1.0)) * 65535.0);
+            texel[1] = (uint16_t)lround(std::max(0.0, std::min(fc.px[1], 1.0)) * 65535.0);
+            texel[2] = (uint16_t)lround(fc.face / 5.0 * 65535.0);
+            texel[3] = (uint16_t)lround(std::max(0.0, std::min(footprint_log2, 1.0)) * 65535.0);
+        }
     }
-    
+
+    glGenTextures(1, &_remap_texture);
+    glBindTexture(GL_TEXTURE_2D, _remap_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, _output_width, _output_height, 0, GL_RGBA, GL_UNSIGNED_SHORT, remap);
     glBindTexture(GL_TEXTURE_2D, 0);
+    _cache->addTexture(key, _remap_texture);
+
+    delete[] remap;
+}
+
+// Decodes the face image read into `_face_bytes[face]` (from `filename`) and uploads it
+void Cube2Equirect::updateTextureFromImage(std::string filename, int face)
+{
+    int width, height;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint8_t *pixels = decodeImage(filename, _face_bytes[face], _face_lengths[face], _face_resolution, &width, &height);
+    _frame_stats.decode_ms += elapsedMs(start);
+
+    uploadFace(filename, face, pixels, width, height);
+    iioFreeImage(pixels);
 }
 
-void Cube2Equirect::updateTextureFromImage(std::string filename, GLuint texture)
+// Decodes a packed frame image (read into `_face_bytes` of the faces in `face_mask`) once, and
+// uploads each of those faces straight from its cell of the decoded image
+void Cube2Equirect::updateTexturesFromPackedImage(std::string filename, int face_mask)
 {
+    int face = 0;
+    while (!(face_mask & (1 << face))) face++;
+
+    // Cells keep at least the face resolution the output needs (the shorter side spans the fewest cells)
     int width, height;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int min_size = _face_resolution * std::min(_layout.columns, _layout.rows);
+    uint8_t *pixels = decodeImage(filename, _face_bytes[face], _face_lengths[face], min_size, &width, &height);
+    _frame_stats.decode_ms += elapsedMs(start);
+
+    int size = width / _layout.columns;
+    if (size == 0 || height / _layout.rows != size)
+    {
+        fail("'%s' (%dx%d) is not a %s layout of square faces", filename.c_str(), width, height, _layout.name.c_str());
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, width);
+    for (face = 0; face < 6; face++)
+    {
+        if (!(face_mask & (1 << face))) continue;
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS, _layout.cells[face][0] * size);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS, _layout.cells[face][1] * size);
+        uploadFace(filename, face, pixels, size, size);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+    iioFreeImage(pixels);
+}
+
+// Decodes an image read into memory to RGBA (at reduced scale, where allowed, as long as both sides
+// stay at least `min_size` pixels)
+uint8_t* Cube2Equirect::decodeImage(std::string filename, const uint8_t *data, size_t size, int min_size, int *width, int *height)
+{
     int channels = 4;
-    uint8_t *pixels = iioReadImage(filename.c_str(), &width, &height, &channels);
+    uint8_t *pixels;
+    if (_options.scaled_decode)
+    {
+        pixels = iioReadImageScaledFromMemory(data, size, min_size, width, height, &channels);
+    }
+    else
+    {
+        pixels = iioReadImageFromMemory(data, size, width, height, &channels);
+    }
     
     if (pixels == NULL)
     {
-        fprintf(stderr, "Error: could not read image '%s'\n", filename.c_str());
-        exit(EXIT_FAILURE);
+        fail("could not read image '%s'", filename.c_str());
+    }
+    return pixels;
+}
+
+// Uploads a face's pixels (a cell of a larger image, when the unpack row length and skips are set)
+void Cube2Equirect::uploadFace(std::string filename, int face, uint8_t *pixels, int width, int height)
+{
+    bool size_changed = (width != _face_sizes[face]);
+    if (size_changed)
+    {
+        _face_sizes[face] = width;
+        _sample_count = 0;
     }
     
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    
-    iioFreeImage(pixels);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (_options.pipeline == "remap")
+    {
+        if (width != height || width != _face_sizes[0])
+        {
+            fail("remap pipeline requires square faces of equal size ('%s' is %dx%d)", filename.c_str(), width, height);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, _cube_array);
+        if (face == 0 && size_changed)
+        {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, width, height, 6, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, face, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, _cube_textures[face]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        if (_options.mipmaps && _degrade_level < 1)
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    if (_options.stats) glFinish();
+    _frame_stats.upload_ms += elapsedMs(start);
 }
 
 /*
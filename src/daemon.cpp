@@ -0,0 +1,261 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <atomic>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "daemon.h"
+
+static const size_t MAX_LINE_LENGTH = 65536;
+
+static volatile sig_atomic_t stop_requested = 0;
+static std::mutex connection_mutex;
+static std::condition_variable connection_closed;
+static int open_connections = 0;
+static std::atomic<int64_t> next_job_id(1);
+
+static void requestStop(int)
+{
+    stop_requested = 1;
+}
+
+static bool makeSocketAddress(std::string socket_path, struct sockaddr_un *address)
+{
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (socket_path.length() >= sizeof(address->sun_path))
+    {
+        fprintf(stderr, "Error: socket path '%s' is too long\n", socket_path.c_str());
+        return false;
+    }
+    strcpy(address->sun_path, socket_path.c_str());
+    return true;
+}
+
+// Reads up to (and drops) the next newline
+static bool readLine(int fd, std::string *line)
+{
+    char c;
+    line->clear();
+    while (line->length() < MAX_LINE_LENGTH)
+    {
+        ssize_t count = read(fd, &c, 1);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        if (c == '\n') return true;
+        *line += c;
+    }
+    return false;
+}
+
+static bool writeAll(int fd, std::string text)
+{
+    size_t written = 0;
+    while (written < text.length())
+    {
+        ssize_t count = write(fd, text.data() + written, text.length() - written);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) return false;
+        written += count;
+    }
+    return true;
+}
+
+static std::string formatJob(const ConversionJob& job)
+{
+    std::string line = "input=" + job.input + "\toutput=" + job.output + "\twidth=" + std::to_string(job.width) + "\tformat=" + job.format;
+    if (!job.client.empty()) line += "\tclient=" + job.client;
+    return line + "\n";
+}
+
+static bool parseJob(std::string line, ConversionJob *job)
+{
+    bool has_input = false;
+    bool has_output = false;
+    job->width = 0;
+    size_t start = 0;
+    while (start <= line.length())
+    {
+        size_t end = line.find('\t', start);
+        if (end == std::string::npos) end = line.length();
+        std::string field = line.substr(start, end - start);
+        size_t equals = field.find('=');
+        std::string key = field.substr(0, equals);
+        std::string value = (equals != std::string::npos) ? field.substr(equals + 1) : "";
+        if (key == "input")
+        {
+            job->input = value;
+            has_input = true;
+        }
+        else if (key == "output")
+        {
+            job->output = value;
+            has_output = true;
+        }
+        else if (key == "width")
+        {
+            job->width = atoi(value.c_str());
+        }
+        else if (key == "format")
+        {
+            job->format = value;
+        }
+        else if (key == "client")
+        {
+            job->client = value;
+        }
+        else
+        {
+            return false;
+        }
+        start = end + 1;
+    }
+    return has_input && has_output && !job->input.empty() && !job->output.empty();
+}
+
+// Serves one job per connection. Jobs are queued by the user that connected (from the socket's peer
+// credentials, which the client cannot choose), and within that by the client name the job gives
+static void serveConnection(int fd, JobRunner *runner)
+{
+    std::string line;
+    ConversionJob job;
+    std::string reply;
+    if (!readLine(fd, &line) || !parseJob(line, &job))
+    {
+        reply = "error malformed job\n";
+    }
+    else
+    {
+        struct ucred peer;
+        socklen_t length = sizeof(peer);
+        job.user = (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) == 0) ? "uid " + std::to_string(peer.uid) : "unknown";
+        std::string submitter = job.client.empty() ? job.user : job.user + ", " + job.client;
+        int64_t id = next_job_id++;
+        if (runner->submit(&job)) runner->wait(&job);
+        if (job.ok)
+        {
+            char text[128];
+            snprintf(text, 128, "ok frames=%d ms=%.1f worker=%d warm=%d\n", job.frames, job.elapsed_ms, job.worker, job.warm ? 1 : 0);
+            reply = text;
+            printf("job %lld (%s): %s -> %s, %d frames in %.1f ms on worker %d%s\n", (long long)id, submitter.c_str(), job.input.c_str(),
+                   job.output.c_str(), job.frames, job.elapsed_ms, job.worker, job.warm ? " (warm)" : "");
+        }
+        else
+        {
+            reply = "error " + job.error + "\n";
+            printf("job %lld (%s): %s -> %s failed: %s\n", (long long)id, submitter.c_str(), job.input.c_str(), job.output.c_str(), job.error.c_str());
+        }
+        fflush(stdout);
+    }
+    writeAll(fd, reply);
+    close(fd);
+
+    std::lock_guard<std::mutex> lock(connection_mutex);
+    open_connections--;
+    connection_closed.notify_all();
+}
+
+// Converts jobs submitted to the socket at `socket_path` on `num_workers` workers, until SIGINT or
+// SIGTERM (after which the running jobs finish, and the queued ones fail)
+int runDaemon(std::string socket_path, int num_workers, C2EOptions options)
+{
+    struct sockaddr_un address;
+    if (!makeSocketAddress(socket_path, &address) || !RenderContext::initialize())
+    {
+        return EXIT_FAILURE;
+    }
+    JobRunner *runner = new JobRunner();
+    if (!runner->start(num_workers, options))
+    {
+        fprintf(stderr, "Error: could not create an OpenGL context for each worker\n");
+        return EXIT_FAILURE;
+    }
+
+    // A socket left behind by an earlier daemon is replaced
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socket_path.c_str());
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, 64) != 0)
+    {
+        fprintf(stderr, "Error: could not listen on '%s'\n", socket_path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Listening on '%s' with %d workers\n", socket_path.c_str(), num_workers);
+    fflush(stdout);
+
+    while (!stop_requested)
+    {
+        struct pollfd listener = {listen_fd, POLLIN, 0};
+        if (poll(&listener, 1, 500) <= 0) continue;
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        std::lock_guard<std::mutex> lock(connection_mutex);
+        open_connections++;
+        std::thread(serveConnection, fd, runner).detach();
+    }
+
+    printf("Shutting down\n");
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    runner->stop();
+    {
+        std::unique_lock<std::mutex> lock(connection_mutex);
+        while (open_connections > 0)
+        {
+            connection_closed.wait(lock);
+        }
+    }
+    delete runner;
+    RenderContext::terminate();
+    return EXIT_SUCCESS;
+}
+
+// Thin client: sends one job to the daemon and waits for it to finish
+int submitJob(std::string socket_path, const ConversionJob& job)
+{
+    struct sockaddr_un address;
+    if (!makeSocketAddress(socket_path, &address))
+    {
+        return EXIT_FAILURE;
+    }
+    std::string fields = job.input + job.output + job.format + job.client;
+    if (fields.find_first_of("\t\n") != std::string::npos)
+    {
+        fprintf(stderr, "Error: job fields cannot contain tabs or newlines\n");
+        return EXIT_FAILURE;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "Error: could not connect to a daemon on '%s'\n", socket_path.c_str());
+        return EXIT_FAILURE;
+    }
+    std::string reply;
+    bool replied = writeAll(fd, formatJob(job)) && readLine(fd, &reply);
+    close(fd);
+    if (!replied)
+    {
+        fprintf(stderr, "Error: the daemon closed the connection before the job finished\n");
+        return EXIT_FAILURE;
+    }
+    if (reply.compare(0, 6, "error ") == 0)
+    {
+        fprintf(stderr, "Error: %s\n", reply.substr(6).c_str());
+        return EXIT_FAILURE;
+    }
+
+    int frames = 0, worker = 0, warm = 0;
+    double elapsed_ms = 0.0;
+    sscanf(reply.c_str(), "ok frames=%d ms=%lf worker=%d warm=%d", &frames, &elapsed_ms, &worker, &warm);
+    printf("Converted %d frames in %.1f ms (worker %d%s)\n", frames, elapsed_ms, worker, warm ? ", warm" : "");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,323 @@
+#include <cmath>
+#include <algorithm>
+#include "eqmap.h"
+
+static const double FACE_AXES[6][3][3] = {
+    // major axis       u axis              v axis
+    {{-1.0, 0.0, 0.0}, { 0.0, 0.0,  1.0}, {0.0, 1.0,  0.0}},  // left
+    {{ 1.0, 0.0, 0.0}, { 0.0, 0.0, -1.0}, {0.0, 1.0,  0.0}},  // right
+    {{0.0,  1.0, 0.0}, { 1.0, 0.0,  0.0}, {0.0, 0.0, -1.0}},  // bottom
+    {{0.0, -1.0, 0.0}, { 1.0, 0.0,  0.0}, {0.0, 0.0,  1.0}},  // top
+    {{0.0, 0.0, -1.0}, {-1.0, 0.0,  0.0}, {0.0, 1.0,  0.0}},  // back
+    {{0.0, 0.0,  1.0}, { 1.0, 0.0,  0.0}, {0.0, 1.0,  0.0}}   // front
+};
+
+static double dot(const double a[3], const double b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Derivative of a face coordinate (0.5 + 0.5 * dot(dir, axis) / dot(dir, major)) along `ddir`
+static void faceDerivative(const double dir[3], const double ddir[3], int face, double dpx[2])
+{
+    double m = dot(dir, FACE_AXES[face][0]);
+    double dm = dot(ddir, FACE_AXES[face][0]);
+    int i;
+    for (i = 0; i < 2; i++)
+    {
+        dpx[i] = 0.5 * (dot(ddir, FACE_AXES[face][i + 1]) * m - dot(dir, FACE_AXES[face][i + 1]) * dm) / (m * m);
+    }
+}
+
+// Equirect position (theta / pi, phi / (pi / 2)) of face coordinate (u, v); `pole` is set for the
+// points straight up or down, where theta is undefined
+static void faceToEquirect(int face, double u, double v, double pos[2], bool *pole)
+{
+    double dir[3];
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        dir[i] = FACE_AXES[face][0][i] + (2.0 * u - 1.0) * FACE_AXES[face][1][i] + (2.0 * v - 1.0) * FACE_AXES[face][2][i];
+    }
+    double horizontal = sqrt(dir[0] * dir[0] + dir[2] * dir[2]);
+    *pole = (horizontal < 1.0e-9);
+    pos[0] = *pole ? 0.0 : atan2(dir[0], dir[2]) / M_PI;
+    pos[1] = atan2(dir[1], horizontal) / (M_PI / 2.0);
+}
+
+static void appendVertex(const double pos[2], const double uv[2], double shift, std::vector<float>& positions, std::vector<float>& texcoords)
+{
+    positions.push_back(pos[0] + shift);
+    positions.push_back(pos[1]);
+    positions.push_back(-1.0f);
+    texcoords.push_back(uv[0]);
+    texcoords.push_back(uv[1]);
+}
+
+// Appends one triangle of face coordinates, unwrapping it across the +/-180 degree seam and
+// stretching it to the full width of the output where it touches a pole
+static void appendTriangle(int face, const double uv[3][2], std::vector<float>& positions, std::vector<float>& texcoords)
+{
+    double pos[4][2];
+    double tri_uv[4][2];
+    bool pole[3];
+    int i, num_vertices = 0, pole_vertex = -1;
+    for (i = 0; i < 3; i++)
+    {
+        faceToEquirect(face, uv[i][0], uv[i][1], pos[i], &pole[i]);
+        if (pole[i]) pole_vertex = i;
+    }
+
+    // Unwrap theta of every vertex to within 180 degrees of the triangle's centroid
+    double center[2];
+    bool center_pole;
+    faceToEquirect(face, (uv[0][0] + uv[1][0] + uv[2][0]) / 3.0, (uv[0][1] + uv[1][1] + uv[2][1]) / 3.0, center, &center_pole);
+    for (i = 0; i < 3; i++)
+    {
+        if (pole[i]) continue;
+        if (pos[i][0] - center[0] > 1.0) pos[i][0] -= 2.0;
+        else if (pos[i][0] - center[0] < -1.0) pos[i][0] += 2.0;
+    }
+
+    if (pole_vertex < 0)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            pos[num_vertices][0] = pos[i][0]; pos[num_vertices][1] = pos[i][1];
+            tri_uv[num_vertices][0] = uv[i][0]; tri_uv[num_vertices][1] = uv[i][1];
+            num_vertices++;
+        }
+    }
+    else
+    {
+        // A triangle touching the pole covers the band between its other two vertices and the pole,
+        // so it becomes a quad with the pole split in two (one at each vertex's longitude)
+        int a = (pole_vertex + 1) % 3;
+        int b = (pole_vertex + 2) % 3;
+        double quad[4][2] = {{pos[a][0], pos[a][1]}, {pos[b][0], pos[b][1]}, {pos[b][0], pos[pole_vertex][1]}, {pos[a][0], pos[pole_vertex][1]}};
+        const double *quad_uv[4] = {uv[a], uv[b], uv[pole_vertex], uv[pole_vertex]};
+        for (i = 0; i < 4; i++)
+        {
+            pos[i][0] = quad[i][0]; pos[i][1] = quad[i][1];
+            tri_uv[i][0] = quad_uv[i][0]; tri_uv[i][1] = quad_uv[i][1];
+        }
+        num_vertices = 4;
+    }
+
+    // Triangles crossing the seam are drawn twice, once on each side of the output
+    double min_x = pos[0][0], max_x = pos[0][0];
+    for (i = 1; i < num_vertices; i++)
+    {
+        min_x = std::min(min_x, pos[i][0]);
+        max_x = std::max(max_x, pos[i][0]);
+    }
+    double shifts[2] = {0.0, (max_x > 1.0) ? -2.0 : ((min_x < -1.0) ? 2.0 : 0.0)};
+    int num_shifts = (shifts[1] != 0.0) ? 2 : 1;
+    int s;
+    for (s = 0; s < num_shifts; s++)
+    {
+        int order[6] = {0, 1, 2, 0, 2, 3};
+        int num_indices = (num_vertices == 4) ? 6 : 3;
+        for (i = 0; i < num_indices; i++)
+        {
+            appendVertex(pos[order[i]], tri_uv[order[i]], shifts[s], positions, texcoords);
+        }
+    }
+}
+
+// Public
+void eqmap::mapToCube(double theta, double phi, const double pixel_angle[2], FaceCoord *fc)
+{
+    double dir[3] = {cos(phi) * sin(theta), sin(phi), cos(phi) * cos(theta)};
+    double ddir_dx[3] = {cos(phi) * cos(theta) * pixel_angle[0], 0.0, -cos(phi) * sin(theta) * pixel_angle[0]};
+    double ddir_dy[3] = {-sin(phi) * sin(theta) * pixel_angle[1], cos(phi) * pixel_angle[1], -sin(phi) * cos(theta) * pixel_angle[1]};
+
+    double ax = fabs(dir[0]), ay = fabs(dir[1]), az = fabs(dir[2]);
+    if (ax >= ay && ax >= az)
+    {
+        fc->face = (dir[0] < 0.0) ? 0 : 1;
+    }
+    else if (ay >= az)
+    {
+        fc->face = (dir[1] < 0.0) ? 3 : 2;
+    }
+    else
+    {
+        fc->face = (dir[2] < 0.0) ? 4 : 5;
+    }
+
+    double scale = 1.0 / dot(dir, FACE_AXES[fc->face][0]);
+    fc->px[0] = (dot(dir, FACE_AXES[fc->face][1]) * scale + 1.0) / 2.0;
+    fc->px[1] = (dot(dir, FACE_AXES[fc->face][2]) * scale + 1.0) / 2.0;
+    faceDerivative(dir, ddir_dx, fc->face, fc->dpx_dx);
+    faceDerivative(dir, ddir_dy, fc->face, fc->dpx_dy);
+}
+
+void eqmap::mapPixel(int x, int y, int width, int height, FaceCoord *fc)
+{
+    // Same as the full-screen quad: pixel centers span texcoords (-1, 1), bottom row first
+    double theta = (((x + 0.5) / width) * 2.0 - 1.0) * M_PI;
+    double phi = (((y + 0.5) / height) * 2.0 - 1.0) * M_PI / 2.0;
+    double pixel_angle[2] = {2.0 * M_PI / width, M_PI / height};
+    mapToCube(theta, phi, pixel_angle, fc);
+}
+
+// Bilinear RGB sample of a square RGBA face (top row first) at face coordinate `px`, clamped to its edges
+static void sampleFace(const uint8_t *face, int size, const double px[2], double rgb[3])
+{
+    double fx = std::max(0.0, std::min(px[0] * size - 0.5, size - 1.0));
+    double fy = std::max(0.0, std::min(px[1] * size - 0.5, size - 1.0));
+    int x0 = (int)fx, y0 = (int)fy;
+    int x1 = std::min(x0 + 1, size - 1), y1 = std::min(y0 + 1, size - 1);
+    double wx = fx - x0, wy = fy - y0;
+    int c;
+    for (c = 0; c < 3; c++)
+    {
+        double top = face[(y0 * size + x0) * 4 + c] * (1.0 - wx) + face[(y0 * size + x1) * 4 + c] * wx;
+        double bottom = face[(y1 * size + x0) * 4 + c] * (1.0 - wx) + face[(y1 * size + x1) * 4 + c] * wx;
+        rgb[c] = top * (1.0 - wy) + bottom * wy;
+    }
+}
+
+// Quality of a converted image (RGBA, rows in the order mapPixel numbers them): its PSNR in dB against
+// a reference that averages `supersample` x `supersample` bilinear face samples over each pixel,
+// measured on every `step`th row and column (99 dB if identical)
+double eqmap::supersampledPsnr(const uint8_t *image, int width, int height, const uint8_t *const faces[6], const int face_sizes[6], int step, int supersample)
+{
+    double pixel_angle[2] = {2.0 * M_PI / width, M_PI / height};
+    double squared_error = 0.0;
+    int64_t count = 0;
+    int x, y, i, j, c;
+    FaceCoord fc;
+    for (y = step / 2; y < height; y += step)
+    {
+        for (x = step / 2; x < width; x += step)
+        {
+            double reference[3] = {0.0, 0.0, 0.0};
+            for (j = 0; j < supersample; j++)
+            {
+                for (i = 0; i < supersample; i++)
+                {
+                    double theta = (((x + (i + 0.5) / supersample) / width) * 2.0 - 1.0) * M_PI;
+                    double phi = (((y + (j + 0.5) / supersample) / height) * 2.0 - 1.0) * M_PI / 2.0;
+                    double rgb[3];
+                    mapToCube(theta, phi, pixel_angle, &fc);
+                    sampleFace(faces[fc.face], face_sizes[fc.face], fc.px, rgb);
+                    for (c = 0; c < 3; c++)
+                    {
+                        reference[c] += rgb[c];
+                    }
+                }
+            }
+            const uint8_t *pixel = image + ((size_t)y * width + x) * 4;
+            for (c = 0; c < 3; c++)
+            {
+                double error = pixel[c] - reference[c] / (supersample * supersample);
+                squared_error += error * error;
+            }
+            count += 3;
+        }
+    }
+    double mse = squared_error / std::max(count, (int64_t)1);
+    return (mse > 0.0) ? std::min(10.0 * log10(255.0 * 255.0 / mse), 99.0) : 99.0;
+}
+
+// Number of samples per axis needed to cover the pixel's footprint on the cube: one per texel
+// when minified, and the maximum when the footprint straddles a face edge
+// (keep in sync with adaptiveSamples() in cube2equirect.frag)
+int eqmap::adaptiveSamples(const FaceCoord& fc, int face_size, int max_samples)
+{
+    int i;
+    for (i = 0; i < 2; i++)
+    {
+        double extent = (fabs(fc.dpx_dx[i]) + fabs(fc.dpx_dy[i])) * 0.5;
+        if (std::min(fc.px[i], 1.0 - fc.px[i]) < extent) return max_samples;
+    }
+    double len_dx = sqrt(fc.dpx_dx[0] * fc.dpx_dx[0] + fc.dpx_dx[1] * fc.dpx_dx[1]);
+    double len_dy = sqrt(fc.dpx_dy[0] * fc.dpx_dy[0] + fc.dpx_dy[1] * fc.dpx_dy[1]);
+    double footprint = std::max(len_dx, len_dy) * face_size;
+    return std::max(1, std::min((int)ceil(footprint - 0.001), max_samples));
+}
+
+int64_t eqmap::countAdaptiveSamples(int width, int height, const int face_sizes[6], int max_samples)
+{
+    if (max_samples <= 1) return (int64_t)width * height;
+
+    int x, y;
+    int64_t total = 0;
+    FaceCoord fc;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            mapPixel(x, y, width, height, &fc);
+            int n = adaptiveSamples(fc, face_sizes[fc.face], max_samples);
+            total += n * n;
+        }
+    }
+    return total;
+}
+
+// Bounding rectangle (x, y, width, height, with row 0 at the bottom) of the output pixels fed by
+// each face, grown by one pixel so pixels whose samples spill across a face edge are included
+void eqmap::faceCoverage(int width, int height, int rects[6][4])
+{
+    int bounds[6][4];
+    int face;
+    for (face = 0; face < 6; face++)
+    {
+        bounds[face][0] = width;
+        bounds[face][1] = height;
+        bounds[face][2] = -1;
+        bounds[face][3] = -1;
+    }
+
+    int x, y;
+    FaceCoord fc;
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            mapPixel(x, y, width, height, &fc);
+            int *b = bounds[fc.face];
+            b[0] = std::min(b[0], x);
+            b[1] = std::min(b[1], y);
+            b[2] = std::max(b[2], x);
+            b[3] = std::max(b[3], y);
+        }
+    }
+
+    for (face = 0; face < 6; face++)
+    {
+        int x0 = std::max(bounds[face][0] - 1, 0);
+        int y0 = std::max(bounds[face][1] - 1, 0);
+        int x1 = std::min(bounds[face][2] + 1, width - 1);
+        int y1 = std::min(bounds[face][3] + 1, height - 1);
+        rects[face][0] = x0;
+        rects[face][1] = y0;
+        rects[face][2] = std::max(x1 - x0 + 1, 0);
+        rects[face][3] = std::max(y1 - y0 + 1, 0);
+    }
+}
+
+// Builds a `density` x `density` grid of cells over one face as a triangle list, with vertex
+// positions in the equirectangular output (clip space) and texcoords on the face
+void eqmap::buildFaceMesh(int face, int density, std::vector<float>& positions, std::vector<float>& texcoords)
+{
+    // An even density puts the poles and the seam on grid lines, so no cell straddles them
+    density = std::max(2, density + (density % 2));
+
+    int i, j;
+    for (j = 0; j < density; j++)
+    {
+        for (i = 0; i < density; i++)
+        {
+            double u0 = (double)i / density, u1 = (double)(i + 1) / density;
+            double v0 = (double)j / density, v1 = (double)(j + 1) / density;
+            double tri0[3][2] = {{u0, v0}, {u1, v0}, {u1, v1}};
+            double tri1[3][2] = {{u0, v0}, {u1, v1}, {u0, v1}};
+            appendTriangle(face, tri0, positions, texcoords);
+            appendTriangle(face, tri1, positions, texcoords);
+        }
+    }
+}
@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stb_image.h"
+#include "facearchive.h"
+
+static int64_t parseTarNumber(const uint8_t *field, int length);
+static uint16_t readU16(const uint8_t *p);
+static uint32_t readU32(const uint8_t *p);
+static uint64_t readU64(const uint8_t *p);
+
+FaceArchive::FaceArchive()
+{
+    _fd = -1;
+    _data = NULL;
+    _size = 0;
+    _device = 0;
+    _inode = 0;
+}
+
+FaceArchive::~FaceArchive()
+{
+    if (_data != NULL) munmap((void*)_data, _size);
+    if (_fd >= 0) close(_fd);
+}
+
+// Public
+// Maps the archive and indexes its members (the format is detected from the contents)
+bool FaceArchive::open(std::string path)
+{
+    _fd = ::open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (_fd < 0 || fstat(_fd, &info) != 0 || info.st_size < 22)
+    {
+        return false;
+    }
+    _size = info.st_size;
+    _device = (int64_t)info.st_dev;
+    _inode = (int64_t)info.st_ino;
+    void *data = mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    _data = (const uint8_t*)data;
+
+    _members.clear();
+    if (readU32(_data) == 0x04034b50 || readU32(_data) == 0x06054b50)
+    {
+        return indexZip();
+    }
+    return indexTar();
+}
+
+bool FaceArchive::isOpen()
+{
+    return _data != NULL;
+}
+
+size_t FaceArchive::size()
+{
+    return _members.size();
+}
+
+const ArchiveMember& FaceArchive::at(size_t idx)
+{
+    return _members[idx];
+}
+
+int64_t FaceArchive::getDevice()
+{
+    return _device;
+}
+
+int64_t FaceArchive::getInode()
+{
+    return _inode;
+}
+
+// Points `data` at a member's contents: in the mapping for stored members, or in `buffer` for
+// deflated ones (which are inflated into it)
+bool FaceArchive::read(size_t idx, std::vector<uint8_t>& buffer, const uint8_t **data, size_t *size)
+{
+    const ArchiveMember& member = _members[idx];
+    if (member.method == 0)
+    {
+        *data = _data + member.offset;
+        *size = member.size;
+        return true;
+    }
+
+    // stb's inflate looks a few bytes past the end of the stream before it sees the final block, so
+    // it is allowed to see what follows in the archive (the stream ends itself either way)
+    buffer.resize(member.size);
+    int64_t input_size = std::min(member.stored_size + 16, (int64_t)_size - member.offset);
+    int length = stbi_zlib_decode_noheader_buffer((char*)buffer.data(), (int)buffer.size(), (const char*)(_data + member.offset), (int)input_size);
+    if (length != (int)member.size)
+    {
+        return false;
+    }
+    *data = buffer.data();
+    *size = buffer.size();
+    return true;
+}
+
+// Asks the kernel to start reading a member's pages
+void FaceArchive::willNeed(size_t idx)
+{
+    const ArchiveMember& member = _members[idx];
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)member.offset & ~(page - 1);
+    madvise((void*)(_data + start), (size_t)(member.offset + member.stored_size) - start, MADV_WILLNEED);
+}
+
+// Private
+// Indexes the regular files of a ustar/GNU/pax tar, resolving hard links to their targets
+bool FaceArchive::indexTar()
+{
+    std::map<std::string, size_t> by_name;
+    std::string long_name = "";
+    int64_t pax_size = -1;
+    int64_t pax_mtime_ns = -1;
+    size_t offset = 0;
+    while (offset + 512 <= _size)
+    {
+        const uint8_t *header = _data + offset;
+        int i;
+        int64_t checksum = 0;
+        for (i = 0; i < 512; i++)
+        {
+            checksum += (i >= 148 && i < 156) ? ' ' : header[i];
+        }
+        if (checksum == 8 * ' ')
+        {
+            break; // end-of-archive (zero) block
+        }
+        if (checksum != parseTarNumber(header + 148, 8))
+        {
+            return false;
+        }
+
+        char type = (char)header[156];
+        int64_t size = (pax_size >= 0) ? pax_size : parseTarNumber(header + 124, 12);
+        size_t data_offset = offset + 512;
+        if (size < 0 || data_offset + size > _size)
+        {
+            return false;
+        }
+        offset = data_offset + ((size + 511) & ~(int64_t)511);
+
+        // Extended headers apply to the next entry
+        if (type == 'L')
+        {
+            long_name.assign((const char*)(_data + data_offset), strnlen((const char*)(_data + data_offset), size));
+            continue;
+        }
+        if (type == 'x')
+        {
+            const char *record = (const char*)(_data + data_offset);
+            const char *records_end = record + size;
+            while (record < records_end)
+            {
+                char *key;
+                long length = strtol(record, &key, 10);
+                if (length <= 0 || record + length > records_end) break;
+                std::string field(key + 1, record + length - 1 - (key + 1));
+                if (field.compare(0, 5, "path=") == 0) long_name = field.substr(5);
+                else if (field.compare(0, 5, "size=") == 0) pax_size = atoll(field.c_str() + 5);
+                else if (field.compare(0, 6, "mtime=") == 0) pax_mtime_ns = (int64_t)(atof(field.c_str() + 6) * 1e9);
+                record += length;
+            }
+            continue;
+        }
+
+        std::string name = long_name;
+        if (name.empty())
+        {
+            name.assign((const char*)header, strnlen((const char*)header, 100));
+            if (memcmp(header + 257, "ustar\0", 6) == 0 && header[345] != '\0')
+            {
+                name = std::string((const char*)(header + 345), strnlen((const char*)(header + 345), 155)) + "/" + name;
+            }
+        }
+        int64_t mtime_ns = (pax_mtime_ns >= 0) ? pax_mtime_ns : parseTarNumber(header + 136, 12) * 1000000000;
+        long_name = "";
+        pax_size = -1;
+        pax_mtime_ns = -1;
+
+        ArchiveMember member;
+        member.name = name;
+        member.mtime_ns = mtime_ns;
+        member.method = 0;
+        if (type == '0' || type == '\0' || type == '7')
+        {
+            member.offset = data_offset;
+            member.stored_size = size;
+            member.size = size;
+            member.data_member = _members.size();
+        }
+        else if (type == '1')
+        {
+            std::string target((const char*)(header + 157), strnlen((const char*)(header + 157), 100));
+            std::map<std::string, size_t>::iterator it = by_name.find(target);
+            if (it == by_name.end()) continue;
+            const ArchiveMember& linked = _members[it->second];
+            member.offset = linked.offset;
+            member.stored_size = linked.stored_size;
+            member.size = linked.size;
+            member.data_member = linked.data_member;
+        }
+        else
+        {
+            continue; // directories, symbolic links, devices, ...
+        }
+        by_name[name] = _members.size();
+        _members.push_back(member);
+    }
+
+    return true;
+}
+
+// Indexes a zip's central directory (zip64 included), keeping stored and deflated files
+bool FaceArchive::indexZip()
+{
+    // The end of central directory record is followed by a comment of up to 64 KB
+    int64_t eocd = (int64_t)_size - 22;
+    int64_t eocd_min = std::max((int64_t)0, eocd - 65535);
+    while (eocd >= eocd_min && readU32(_data + eocd) != 0x06054b50)
+    {
+        eocd--;
+    }
+    if (eocd < eocd_min)
+    {
+        return false;
+    }
+    uint64_t count = readU16(_data + eocd + 10);
+    uint64_t directory_offset = readU32(_data + eocd + 16);
+    if (count == 0xFFFF || directory_offset == 0xFFFFFFFF)
+    {
+        int64_t locator = eocd - 20;
+        if (locator < 0 || readU32(_data + locator) != 0x07064b50)
+        {
+            return false;
+        }
+        uint64_t record = readU64(_data + locator + 8);
+        if (record + 56 > _size || readU32(_data + record) != 0x06064b50)
+        {
+            return false;
+        }
+        count = readU64(_data + record + 32);
+        directory_offset = readU64(_data + record + 48);
+    }
+
+    uint64_t offset = directory_offset;
+    uint64_t i;
+    for (i = 0; i < count; i++)
+    {
+        if (offset + 46 > _size || readU32(_data + offset) != 0x02014b50)
+        {
+            return false;
+        }
+        const uint8_t *entry = _data + offset;
+        uint16_t flags = readU16(entry + 8);
+        int method = readU16(entry + 10);
+        size_t name_length = readU16(entry + 28);
+        size_t extra_length = readU16(entry + 30);
+        size_t comment_length = readU16(entry + 32);
+        if (offset + 46 + name_length + extra_length > _size)
+        {
+            return false;
+        }
+        offset += 46 + name_length + extra_length + comment_length;
+
+        ArchiveMember member;
+        member.name.assign((const char*)(entry + 46), name_length);
+        member.method = method;
+        member.stored_size = readU32(entry + 20);
+        member.size = readU32(entry + 24);
+        int64_t local_offset = readU32(entry + 42);
+        if ((flags & 1) || (method != 0 && method != 8) || member.name.empty() || member.name[member.name.length() - 1] == '/')
+        {
+            continue; // encrypted, unsupported compression, or a directory
+        }
+
+        // DOS time (local, 2 second resolution), unless an extended timestamp is present
+        uint16_t dos_time = readU16(entry + 12);
+        uint16_t dos_date = readU16(entry + 14);
+        struct tm tm_info;
+        memset(&tm_info, 0, sizeof(tm_info));
+        tm_info.tm_year = (dos_date >> 9) + 80;
+        tm_info.tm_mon = ((dos_date >> 5) & 0xF) - 1;
+        tm_info.tm_mday = dos_date & 0x1F;
+        tm_info.tm_hour = dos_time >> 11;
+        tm_info.tm_min = (dos_time >> 5) & 0x3F;
+        tm_info.tm_sec = (dos_time & 0x1F) * 2;
+        tm_info.tm_isdst = -1;
+        member.mtime_ns = (int64_t)mktime(&tm_info) * 1000000000;
+        if (!applyExtraFields(entry + 46 + name_length, extra_length, &member, &local_offset))
+        {
+            return false;
+        }
+
+        // Data follows the local header, whose name and extra field lengths may differ
+        if ((uint64_t)local_offset + 30 > _size || readU32(_data + local_offset) != 0x04034b50)
+        {
+            return false;
+        }
+        member.offset = local_offset + 30 + readU16(_data + local_offset + 26) + readU16(_data + local_offset + 28);
+        if ((uint64_t)(member.offset + member.stored_size) > _size || (method == 0 && member.stored_size != member.size))
+        {
+            return false;
+        }
+        member.data_member = _members.size();
+        _members.push_back(member);
+    }
+
+    return true;
+}
+
+// Applies the zip64 (0x0001) and extended timestamp (0x5455) extra fields of a central directory entry
+bool FaceArchive::applyExtraFields(const uint8_t *extra, size_t extra_length, ArchiveMember *member, int64_t *local_offset)
+{
+    size_t offset = 0;
+    while (offset + 4 <= extra_length)
+    {
+        uint16_t id = readU16(extra + offset);
+        size_t length = readU16(extra + offset + 2);
+        const uint8_t *field = extra + offset + 4;
+        if (offset + 4 + length > extra_length)
+        {
+            return false;
+        }
+        if (id == 0x0001)
+        {
+            // Only the values that did not fit are present, in this order
+            size_t position = 0;
+            if (member->size == 0xFFFFFFFF && position + 8 <= length) { member->size = readU64(field + position); position += 8; }
+            if (member->stored_size == 0xFFFFFFFF && position + 8 <= length) { member->stored_size = readU64(field + position); position += 8; }
+            if (*local_offset == 0xFFFFFFFF && position + 8 <= length) { *local_offset = readU64(field + position); position += 8; }
+        }
+        else if (id == 0x5455 && length >= 5 && (field[0] & 1))
+        {
+            member->mtime_ns = (int64_t)(int32_t)readU32(field + 1) * 1000000000;
+        }
+        offset += 4 + length;
+    }
+    return true;
+}
+
+// Octal (NUL or space terminated), or base-256 when the high bit of the first byte is set
+static int64_t parseTarNumber(const uint8_t *field, int length)
+{
+    int64_t value = 0;
+    int i;
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x7F;
+        for (i = 1; i < length; i++)
+        {
+            value = (value << 8) | field[i];
+        }
+        return value;
+    }
+    for (i = 0; i < length && field[i] == ' '; i++);
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++)
+    {
+        value = (value << 3) | (field[i] - '0');
+    }
+    return value;
+}
+
+static uint16_t readU16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t readU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t readU64(const uint8_t *p)
+{
+    return (uint64_t)readU32(p) | ((uint64_t)readU32(p + 4) << 32);
+}
@@ -0,0 +1,389 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "frameindex.h"
+
+const char *FrameIndex::FACE_NAMES[6] = {"left", "right", "bottom", "top", "back", "front"};
+
+// Packed layouts hold each face in the same orientation as a separate face file
+static const CubeLayout LAYOUTS[4] = {
+    {"faces", 0, 0, {{0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}}},
+    {"cross", 4, 3, {{0, 1}, {2, 1}, {1, 2}, {1, 0}, {3, 1}, {1, 1}}},     //    top
+                                                                            // left front right back
+                                                                            //    bottom
+    {"3x2", 3, 2, {{0, 0}, {1, 0}, {2, 0}, {0, 1}, {1, 1}, {2, 1}}},       // left right bottom / top back front
+    {"6x1", 6, 1, {{0, 0}, {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0}}}        // left right bottom top back front
+};
+
+FrameIndex::FrameIndex()
+{
+    _packed = false;
+    _start = 0;
+    _end = -1;
+    _stride = 1;
+    _watch_fd = -1;
+    _watch_dir_fd = -1;
+}
+
+FrameIndex::~FrameIndex()
+{
+    if (_watch_fd >= 0) close(_watch_fd);
+    if (_watch_dir_fd >= 0) close(_watch_dir_fd);
+}
+
+// Public
+bool FrameIndex::findLayout(std::string name, CubeLayout *layout)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        if (name == LAYOUTS[i].name)
+        {
+            *layout = LAYOUTS[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Indexes 'NNNNNN_<face>.<ext>' files, or 'NNNNNN.<ext>' files holding all six faces if `packed`
+bool FrameIndex::scan(std::string dir, bool packed)
+{
+    _packed = packed;
+    DIR *dp = opendir(dir.c_str());
+    if (dp == NULL)
+    {
+        return false;
+    }
+    if (dir[dir.length() - 1] != '/')
+    {
+        dir += "/";
+    }
+
+    // Collect face files by frame number (missing faces have an empty path)
+    std::map<int, FrameEntry> frames;
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL)
+    {
+        int number, face;
+        FaceFile file;
+        if (readFace(dirfd(dp), dir, entry->d_name, &number, &face, &file))
+        {
+            addFace(frames, number, face, file);
+        }
+    }
+    closedir(dp);
+
+    keepCompleteFrames(frames);
+
+    return true;
+}
+
+// Indexes the frames already in `dir` (like scan), then watches it for more. Faces count once they are
+// closed after writing or moved into place; files there before the watch began are taken as complete
+bool FrameIndex::watch(std::string dir, bool packed)
+{
+    if (dir[dir.length() - 1] != '/')
+    {
+        dir += "/";
+    }
+    _watch_dir = dir;
+
+    // Watching starts before the scan, so no face written in between is missed
+    _watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    _watch_dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (_watch_fd < 0 || _watch_dir_fd < 0 || inotify_add_watch(_watch_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+    {
+        return false;
+    }
+    return scan(dir, packed);
+}
+
+// Waits until more frames in the selected range are complete, and adds them to the index (in order of
+// completion, then frame number). Returns false once `sentinel` exists in the directory (after adding
+// the frames completed before it appeared), or after `idle_ms` (if > 0) with no files arriving; frames
+// still missing faces are then dropped
+bool FrameIndex::waitForFrames(int idle_ms, std::string sentinel)
+{
+    size_t count = _frames.size();
+    std::string sentinel_path = _watch_dir + sentinel;
+    while (true)
+    {
+        // Every face closed before the sentinel appeared is already queued when it is seen
+        struct stat info;
+        bool ended = !sentinel.empty() && stat(sentinel_path.c_str(), &info) == 0;
+        readWatchEvents();
+        if (_frames.size() > count)
+        {
+            return true;
+        }
+        if (ended)
+        {
+            dropPartialFrames();
+            return false;
+        }
+
+        struct pollfd fd = {_watch_fd, POLLIN, 0};
+        int ready = poll(&fd, 1, (idle_ms > 0) ? idle_ms : -1);
+        if (ready == 0 || (ready < 0 && errno != EINTR))
+        {
+            dropPartialFrames();
+            return false;
+        }
+    }
+}
+
+// Indexes the members of an opened archive (the directories within it are ignored, so faces are
+// matched by file name alone)
+void FrameIndex::scanArchive(FaceArchive& archive, std::string archive_path, bool packed)
+{
+    _packed = packed;
+    std::map<int, FrameEntry> frames;
+    size_t i;
+    for (i = 0; i < archive.size(); i++)
+    {
+        const ArchiveMember& member = archive.at(i);
+        size_t slash = member.name.find_last_of('/');
+        const char *name = member.name.c_str() + ((slash != std::string::npos) ? slash + 1 : 0);
+        int number, face;
+        std::string format;
+        if (!parseFaceName(name, &number, &face, &format)) continue;
+
+        // Members holding the same data (tar hard links) count as the same file
+        FaceFile file;
+        file.path = archive_path + ":" + member.name;
+        file.format = format;
+        file.size = member.size;
+        file.mtime_ns = member.mtime_ns;
+        file.device = archive.getDevice();
+        file.inode = archive.getInode();
+        file.member = member.data_member;
+        addFace(frames, number, face, file);
+    }
+
+    keepCompleteFrames(frames);
+}
+
+// Keeps frames numbered `start` to `end` (inclusive, -1 for no limit) every `stride` frame numbers,
+// then keeps the `shard_index` (0-based) of `shard_count` contiguous, balanced blocks of those.
+// Returns the number of frames in the range across all shards
+size_t FrameIndex::select(int start, int end, int stride, int shard_index, int shard_count)
+{
+    _start = start;
+    _end = end;
+    _stride = stride;
+
+    std::vector<FrameEntry> range;
+    size_t i;
+    for (i = 0; i < _frames.size(); i++)
+    {
+        int number = _frames[i].number;
+        if (number < start || (end >= 0 && number > end) || (number - start) % stride != 0) continue;
+        range.push_back(_frames[i]);
+    }
+
+    // Block boundaries depend only on the range, so every node computes the same split
+    size_t first = (size_t)((int64_t)range.size() * shard_index / shard_count);
+    size_t last = (size_t)((int64_t)range.size() * (shard_index + 1) / shard_count);
+    _frames.assign(range.begin() + first, range.begin() + last);
+
+    return range.size();
+}
+
+size_t FrameIndex::size()
+{
+    return _frames.size();
+}
+
+const FrameEntry& FrameIndex::at(size_t idx)
+{
+    return _frames[idx];
+}
+
+// Private
+// Matches 'NNNNNN_<face>.<ext>', or 'NNNNNN.<ext>' when packed (which sets `face` to -1 for all
+// faces); ext is 'jpg', 'jpeg', or 'png'
+bool FrameIndex::parseFaceName(const char *name, int *number, int *face, std::string *format)
+{
+    char *end;
+    if (name[0] < '0' || name[0] > '9') return false;
+    long value = strtol(name, &end, 10);
+    if (*end != (_packed ? '.' : '_')) return false;
+    const char *face_name = end + 1;
+    const char *ext = _packed ? end : strrchr(face_name, '.');
+    if (ext == NULL) return false;
+
+    *format = ext + 1;
+    if (*format == "jpeg") *format = "jpg";
+    if (*format != "jpg" && *format != "png") return false;
+
+    *number = (int)value;
+    if (_packed)
+    {
+        *face = -1;
+        return true;
+    }
+    for (*face = 0; *face < 6; (*face)++)
+    {
+        size_t length = strlen(FACE_NAMES[*face]);
+        if ((size_t)(ext - face_name) == length && strncmp(face_name, FACE_NAMES[*face], length) == 0) break;
+    }
+    return *face < 6;
+}
+
+// Describes a face image in `dir` (opened as `dir_fd`), if `name` is one
+bool FrameIndex::readFace(int dir_fd, std::string dir, const char *name, int *number, int *face, FaceFile *file)
+{
+    std::string format;
+    if (!parseFaceName(name, number, face, &format)) return false;
+
+    // File attributes come back with the directory listing on most (including network) filesystems
+    struct stat info;
+    if (fstatat(dir_fd, name, &info, 0) != 0 || S_ISDIR(info.st_mode)) return false;
+
+    file->path = dir + name;
+    file->format = format;
+    file->size = info.st_size;
+    file->mtime_ns = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    file->device = (int64_t)info.st_dev;
+    file->inode = (int64_t)info.st_ino;
+    file->member = -1;
+    return true;
+}
+
+// Sets a frame's face (or all faces, for -1) to `file`
+void FrameIndex::addFace(std::map<int, FrameEntry>& frames, int number, int face, const FaceFile& file)
+{
+    FrameEntry& frame = frames[number];
+    frame.number = number;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        if (face == i || face == -1) frame.faces[i] = file;
+    }
+}
+
+// Keeps complete frames in order (a watched directory's incomplete frames wait for their other faces)
+void FrameIndex::keepCompleteFrames(std::map<int, FrameEntry>& frames)
+{
+    _frames.clear();
+    std::map<int, FrameEntry>::iterator it;
+    for (it = frames.begin(); it != frames.end(); it++)
+    {
+        int face;
+        for (face = 0; face < 6; face++)
+        {
+            if (it->second.faces[face].path.empty()) break;
+        }
+        if (face < 6 && _watch_fd >= 0)
+        {
+            _partial[it->first] = it->second;
+            continue;
+        }
+        if (face < 6)
+        {
+            fprintf(stderr, "Warning: skipping frame %06d (missing '%s' face)\n", it->first, FACE_NAMES[face]);
+            continue;
+        }
+        _frames.push_back(it->second);
+        _indexed.insert(it->first);
+    }
+}
+
+// Adds the faces written to the watched directory since the last call, then indexes the frames they
+// complete. A new file counts once closed after writing or moved into place, or at once if it is a link
+// (to a face already written)
+void FrameIndex::readWatchEvents()
+{
+    alignas(struct inotify_event) char buffer[16384];
+    ssize_t length;
+    while ((length = read(_watch_fd, buffer, sizeof(buffer))) > 0)
+    {
+        const struct inotify_event *event;
+        ssize_t offset;
+        for (offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len)
+        {
+            event = (const struct inotify_event*)(buffer + offset);
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                rescanWatchedDirectory();
+                continue;
+            }
+            if (event->len == 0) continue;
+            struct stat info;
+            if ((event->mask & IN_CREATE) && (fstatat(_watch_dir_fd, event->name, &info, AT_SYMLINK_NOFOLLOW) != 0 ||
+                                              (!S_ISLNK(info.st_mode) && info.st_nlink < 2)))
+            {
+                continue;
+            }
+
+            int number, face;
+            FaceFile file;
+            if (readFace(_watch_dir_fd, _watch_dir, event->name, &number, &face, &file) && _indexed.count(number) == 0)
+            {
+                addFace(_partial, number, face, file);
+            }
+        }
+    }
+
+    // Frames outside the selected range are never converted, but still count as seen
+    std::map<int, FrameEntry>::iterator it = _partial.begin();
+    while (it != _partial.end())
+    {
+        int face;
+        for (face = 0; face < 6 && !it->second.faces[face].path.empty(); face++);
+        if (face < 6)
+        {
+            it++;
+            continue;
+        }
+        int number = it->first;
+        if (number >= _start && (_end < 0 || number <= _end) && (number - _start) % _stride == 0)
+        {
+            _frames.push_back(it->second);
+        }
+        _indexed.insert(number);
+        _partial.erase(it++);
+    }
+}
+
+// Events were lost, so every face file now in the directory is taken as written
+void FrameIndex::rescanWatchedDirectory()
+{
+    DIR *dp = opendir(_watch_dir.c_str());
+    if (dp == NULL)
+    {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL)
+    {
+        int number, face;
+        FaceFile file;
+        if (readFace(dirfd(dp), _watch_dir, entry->d_name, &number, &face, &file) && _indexed.count(number) == 0)
+        {
+            addFace(_partial, number, face, file);
+        }
+    }
+    closedir(dp);
+}
+
+void FrameIndex::dropPartialFrames()
+{
+    std::map<int, FrameEntry>::iterator it;
+    for (it = _partial.begin(); it != _partial.end(); it++)
+    {
+        int face;
+        for (face = 0; face < 6 && !it->second.faces[face].path.empty(); face++);
+        fprintf(stderr, "Warning: skipping frame %06d (missing '%s' face)\n", it->first, FACE_NAMES[face]);
+    }
+    _partial.clear();
+}
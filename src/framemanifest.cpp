@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include "framemanifest.h"
+#include "xxhash64.h"
+
+// Each record is one line:
+//   frame <number> <params hash> <output> <output size> <output mtime> (<face size> <face mtime> <face hash>) x 6
+
+FrameManifest::FrameManifest()
+{
+    _fd = -1;
+}
+
+FrameManifest::~FrameManifest()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+// Public
+bool FrameManifest::open(std::string path)
+{
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (_fd < 0)
+    {
+        return false;
+    }
+
+    // Load existing records; a torn or malformed line (e.g. from a killed worker) is ignored
+    _records.clear();
+    _content.clear();
+    FILE *fp = fopen(path.c_str(), "r");
+    if (fp != NULL)
+    {
+        char line[1024];
+        while (fgets(line, 1024, fp) != NULL)
+        {
+            FrameRecord record;
+            if (parseRecord(line, &record))
+            {
+                addRecord(record);
+            }
+        }
+        fclose(fp);
+    }
+
+    return true;
+}
+
+const FrameRecord* FrameManifest::find(int number)
+{
+    std::map<int, FrameRecord>::iterator it = _records.find(number);
+    return (it != _records.end()) ? &(it->second) : NULL;
+}
+
+// Latest record (of any frame) made from the content with the given key
+const FrameRecord* FrameManifest::findContent(uint64_t content_key)
+{
+    std::map<uint64_t, int>::iterator it = _content.find(content_key);
+    if (it == _content.end())
+    {
+        return NULL;
+    }
+
+    // The frame may have been re-recorded with different content since
+    const FrameRecord *record = find(it->second);
+    if (record == NULL || contentKey(record->params_hash, record->face_hash) != content_key)
+    {
+        return NULL;
+    }
+    return record;
+}
+
+bool FrameManifest::append(const FrameRecord& record)
+{
+    char line[1024];
+    int length = snprintf(line, 1024, "frame %d %016llx %s %lld %lld", record.number, (unsigned long long)record.params_hash,
+                          record.output.c_str(), (long long)record.output_size, (long long)record.output_mtime_ns);
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        length += snprintf(line + length, 1024 - length, " %lld %lld %016llx", (long long)record.face_size[i], (long long)record.face_mtime_ns[i],
+                           (unsigned long long)record.face_hash[i]);
+    }
+    length += snprintf(line + length, 1024 - length, "\n");
+    if (length >= 1024)
+    {
+        return false;
+    }
+
+    // The lock covers writers on filesystems where O_APPEND alone does not serialize appends
+    flock(_fd, LOCK_EX);
+    bool ok = (write(_fd, line, length) == length);
+    flock(_fd, LOCK_UN);
+    if (ok)
+    {
+        addRecord(record);
+    }
+
+    return ok;
+}
+
+// Key identifying the output made from six faces with the given conversion parameters
+uint64_t FrameManifest::contentKey(uint64_t params_hash, const uint64_t face_hash[6])
+{
+    uint64_t key_data[7];
+    key_data[0] = params_hash;
+    memcpy(key_data + 1, face_hash, 6 * sizeof(uint64_t));
+    return xxh64(key_data, sizeof(key_data), 0);
+}
+
+// Private
+bool FrameManifest::parseRecord(const char *line, FrameRecord *record)
+{
+    if (line[strlen(line) - 1] != '\n')
+    {
+        return false;
+    }
+
+    char output[512];
+    unsigned long long params_hash;
+    long long output_size, output_mtime_ns;
+    int offset;
+    if (sscanf(line, "frame %d %llx %511s %lld %lld%n", &record->number, &params_hash, output, &output_size, &output_mtime_ns, &offset) != 5)
+    {
+        return false;
+    }
+    record->params_hash = params_hash;
+    record->output = output;
+    record->output_size = output_size;
+    record->output_mtime_ns = output_mtime_ns;
+
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        long long face_size, face_mtime_ns;
+        unsigned long long face_hash;
+        int length;
+        if (sscanf(line + offset, " %lld %lld %llx%n", &face_size, &face_mtime_ns, &face_hash, &length) != 3)
+        {
+            return false;
+        }
+        record->face_size[i] = face_size;
+        record->face_mtime_ns[i] = face_mtime_ns;
+        record->face_hash[i] = face_hash;
+        offset += length;
+    }
+
+    return true;
+}
+
+void FrameManifest::addRecord(const FrameRecord& record)
+{
+    _records[record.number] = record;
+
+    // Only hashed records can be found by content
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        if (record.face_hash[i] == 0) return;
+    }
+    _content[contentKey(record.params_hash, record.face_hash)] = record.number;
+}
@@ -0,0 +1,565 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include "framesource.h"
+
+PipeSource::PipeSource()
+{
+    _pid = -1;
+    _fd = -1;
+    _format = STREAM_PAM;
+    _raw_width = 0;
+    _raw_height = 0;
+    _wake_fd = eventfd(0, EFD_CLOEXEC);
+    _buffer.resize(65536);
+    _buffer_pos = 0;
+    _buffer_end = 0;
+    _current = -1;
+    _frame_count = 0;
+    _ended = false;
+    _stop = false;
+    int i;
+    for (i = 0; i < 3; i++)
+    {
+        _free.push_back(i);
+    }
+}
+
+PipeSource::~PipeSource()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+
+    // Wake a read in progress (the stream may never end, or never send anything again)
+    uint64_t wake = 1;
+    if (write(_wake_fd, &wake, sizeof(wake)) < 0) {}
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    close(_wake_fd);
+
+    // A decoder is stopped (the pipe is ours to close, unlike a stream we were given)
+    if (_pid > 0)
+    {
+        close(_fd);
+        kill(_pid, SIGTERM);
+        waitpid(_pid, NULL, 0);
+    }
+}
+
+// Public
+// Whether a path names a video file (or, with '%s' in place of the face name, six face videos)
+bool PipeSource::isVideoPath(std::string path)
+{
+    static const char *extensions[] = {"mp4", "m4v", "mov", "mkv", "webm", "avi", "ts", "mts", "mpg", "mpeg", "y4m"};
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+    {
+        return false;
+    }
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    size_t i;
+    for (i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+    {
+        if (ext == extensions[i]) return true;
+    }
+    return false;
+}
+
+// Starts `decoder` (ffmpeg, or a command taking the same arguments) on one video holding the faces in
+// a packed `layout`, or on six face videos (left, right, bottom, top, back, front), which it stacks
+// side by side into a 6x1 strip
+bool PipeSource::start(std::string decoder, const std::vector<std::string>& paths, const CubeLayout& layout)
+{
+    _decoder = decoder;
+    _layout = layout;
+
+    std::vector<std::string> args;
+    args.push_back(decoder);
+    args.push_back("-v");
+    args.push_back("error");
+    args.push_back("-nostdin");
+    size_t i;
+    for (i = 0; i < paths.size(); i++)
+    {
+        args.push_back("-i");
+        args.push_back(paths[i]);
+    }
+    if (paths.size() == 6)
+    {
+        args.push_back("-filter_complex");
+        args.push_back("[0:v][1:v][2:v][3:v][4:v][5:v]hstack=inputs=6");
+        FrameIndex::findLayout("6x1", &_layout);
+    }
+    args.push_back("-f");
+    args.push_back("image2pipe");
+    args.push_back("-c:v");
+    args.push_back("pam");
+    args.push_back("-pix_fmt");
+    args.push_back("rgba");
+    args.push_back("-");
+    std::vector<char*> argv;
+    for (i = 0; i < args.size(); i++)
+    {
+        argv.push_back((char*)args[i].c_str());
+    }
+    argv.push_back(NULL);
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        return false;
+    }
+    _pid = fork();
+    if (_pid == 0)
+    {
+        // The decoder gets nothing on stdin (which may be carrying other data)
+        int null_fd = open("/dev/null", O_RDONLY);
+        dup2(null_fd, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    if (_pid < 0)
+    {
+        close(fds[0]);
+        return false;
+    }
+    _fd = fds[0];
+
+    // A larger pipe lets the decoder run further ahead (this is only a hint)
+    fcntl(_fd, F_SETPIPE_SZ, 1 << 20);
+
+    _thread = std::thread(&PipeSource::run, this);
+    return true;
+}
+
+// Reads frames of six raw RGBA faces (left, right, bottom, top, back, front, each `face_width` x
+// `face_height` with the top row first) from `fd`. A size of 0 reads it from a one line header at the
+// start of the stream, 'C2ERAW <width> <height>'
+void PipeSource::openRaw(int fd, int face_width, int face_height)
+{
+    _fd = fd;
+    _decoder = "raw";
+    _format = STREAM_RAW;
+    _raw_width = face_width;
+    _raw_height = face_height;
+
+    // The faces follow each other, like a strip of six cells stacked vertically
+    _layout.name = "raw";
+    _layout.columns = 1;
+    _layout.rows = 6;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        _layout.cells[i][0] = 0;
+        _layout.cells[i][1] = i;
+    }
+
+    _thread = std::thread(&PipeSource::run, this);
+}
+
+const char* PipeSource::name()
+{
+    return _decoder.c_str();
+}
+
+bool PipeSource::hasMoreFrames()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_ready.empty() && !_ended)
+        {
+            _cv.wait(lock);
+        }
+        if (!_ready.empty())
+        {
+            return true;
+        }
+    }
+
+    // The reader has stopped, so the stream ended (or failed); a decoder that failed says so on exit
+    if (_error.empty() && _pid > 0)
+    {
+        _error = finishDecoder();
+    }
+    return false;
+}
+
+// Returns the next frame (after hasMoreFrames found one), which stays valid until the next call
+const SourceFrame& PipeSource::nextFrame()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_current >= 0)
+    {
+        _free.push_back(_current);
+    }
+    _current = _ready.front();
+    _ready.pop_front();
+    _cv.notify_all();
+
+    const Image& image = _images[_current];
+    int cell_width = image.width / _layout.columns;
+    int cell_height = image.height / _layout.rows;
+    _frame.number = _frame_count++;
+    _frame.row_length = image.width;
+    _frame.timestamp_ns = image.timestamp_ns;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        size_t x = (size_t)_layout.cells[i][0] * cell_width;
+        size_t y = (size_t)_layout.cells[i][1] * cell_height;
+        _frame.faces[i] = image.pixels.data() + (y * image.width + x) * 4;
+        _frame.width[i] = cell_width;
+        _frame.height[i] = cell_height;
+    }
+    return _frame;
+}
+
+bool PipeSource::isFrameWaiting()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return !_ready.empty();
+}
+
+// Why the stream ended early (empty if it ended normally)
+std::string PipeSource::getError()
+{
+    return _error;
+}
+
+// Private
+void PipeSource::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        while (!_stop && _free.empty())
+        {
+            _cv.wait(lock);
+        }
+        if (_stop)
+        {
+            break;
+        }
+        int idx = _free.front();
+        _free.pop_front();
+
+        lock.unlock();
+        std::string error;
+        bool ok = readImage(_images[idx], &error);
+        lock.lock();
+
+        if (!ok)
+        {
+            _error = error;
+            break;
+        }
+        _images[idx].timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        _ready.push_back(idx);
+        _cv.notify_all();
+    }
+    _ended = true;
+    _cv.notify_all();
+}
+
+// Reads one PAM image ('P7' header, then rows of RGBA pixels), or one frame of raw faces. Returns false
+// at the end of the stream, or with `error` set if the stream is not what was expected
+bool PipeSource::readImage(Image& image, std::string *error)
+{
+    if (_format == STREAM_RAW)
+    {
+        return readRawFaces(image, error);
+    }
+
+    std::string line;
+    if (!readLine(line))
+    {
+        return false;
+    }
+    if (line != "P7")
+    {
+        *error = "decoder output is not a PAM image stream";
+        return false;
+    }
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+    int maxval = 0;
+    while (true)
+    {
+        if (!readLine(line))
+        {
+            *error = "decoder output ended within a frame header";
+            return false;
+        }
+        if (line == "ENDHDR") break;
+
+        char key[16];
+        int value;
+        if (sscanf(line.c_str(), "%15s %d", key, &value) != 2) continue;
+        if (strcmp(key, "WIDTH") == 0) width = value;
+        else if (strcmp(key, "HEIGHT") == 0) height = value;
+        else if (strcmp(key, "DEPTH") == 0) depth = value;
+        else if (strcmp(key, "MAXVAL") == 0) maxval = value;
+    }
+    if (width <= 0 || height <= 0 || depth != 4 || maxval != 255)
+    {
+        *error = "decoder output is not 8-bit RGBA";
+        return false;
+    }
+    int size = width / _layout.columns;
+    if (size == 0 || height / _layout.rows != size)
+    {
+        char message[128];
+        snprintf(message, 128, "video frames (%dx%d) are not a %s layout of square faces", width, height, _layout.name.c_str());
+        *error = message;
+        return false;
+    }
+
+    image.pixels.resize((size_t)width * height * 4);
+    if (!readBytes(image.pixels.data(), image.pixels.size()))
+    {
+        *error = "decoder output ended within a frame";
+        return false;
+    }
+    image.width = width;
+    image.height = height;
+    return true;
+}
+
+bool PipeSource::readRawFaces(Image& image, std::string *error)
+{
+    if (_raw_width == 0)
+    {
+        std::string line;
+        if (!readLine(line))
+        {
+            return false;
+        }
+        if (sscanf(line.c_str(), "C2ERAW %d %d", &_raw_width, &_raw_height) != 2 || _raw_width <= 0 || _raw_height <= 0)
+        {
+            *error = "raw face stream does not start with a 'C2ERAW <width> <height>' header";
+            return false;
+        }
+    }
+
+    // The end of the stream is only expected between frames
+    image.pixels.resize((size_t)_raw_width * _raw_height * 4 * 6);
+    if (_buffer_pos == _buffer_end)
+    {
+        ssize_t count = readSome(_buffer.data(), _buffer.size());
+        if (count <= 0)
+        {
+            return false;
+        }
+        _buffer_pos = 0;
+        _buffer_end = (size_t)count;
+    }
+    if (!readBytes(image.pixels.data(), image.pixels.size()))
+    {
+        *error = "raw face stream ended within a frame";
+        return false;
+    }
+    image.width = _raw_width;
+    image.height = _raw_height * 6;
+    return true;
+}
+
+// Reads up to (not including) the next newline
+bool PipeSource::readLine(std::string& line)
+{
+    line.clear();
+    while (true)
+    {
+        if (_buffer_pos == _buffer_end)
+        {
+            ssize_t count = readSome(_buffer.data(), _buffer.size());
+            if (count <= 0)
+            {
+                return false;
+            }
+            _buffer_pos = 0;
+            _buffer_end = (size_t)count;
+        }
+        char c = (char)_buffer[_buffer_pos++];
+        if (c == '\n') return true;
+        line += c;
+    }
+}
+
+// Reads exactly `length` bytes (what is left in the buffer first, then straight from the pipe)
+bool PipeSource::readBytes(uint8_t *data, size_t length)
+{
+    size_t buffered = std::min(length, _buffer_end - _buffer_pos);
+    memcpy(data, _buffer.data() + _buffer_pos, buffered);
+    _buffer_pos += buffered;
+    size_t done = buffered;
+    while (done < length)
+    {
+        ssize_t count = readSome(data + done, length - done);
+        if (count <= 0)
+        {
+            return false;
+        }
+        done += (size_t)count;
+    }
+    return true;
+}
+
+// Reads what is available (waiting for something), returning 0 at the end of the stream or once woken
+// to stop, and -1 on errors
+ssize_t PipeSource::readSome(uint8_t *data, size_t length)
+{
+    struct pollfd fds[2] = {{_fd, POLLIN, 0}, {_wake_fd, POLLIN, 0}};
+    while (true)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (fds[1].revents != 0)
+        {
+            return 0;
+        }
+        ssize_t count = read(_fd, data, length);
+        if (count < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        return count;
+    }
+}
+
+// Waits for the decoder to exit, returning an error if it failed
+std::string PipeSource::finishDecoder()
+{
+    int status = 0;
+    pid_t pid = _pid;
+    _pid = -1;
+    if (waitpid(pid, &status, 0) != pid)
+    {
+        return "";
+    }
+    char message[256];
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+    {
+        snprintf(message, 256, "could not run decoder '%s'", _decoder.c_str());
+        return message;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    {
+        snprintf(message, 256, "decoder '%s' exited with status %d", _decoder.c_str(), WEXITSTATUS(status));
+        return message;
+    }
+    if (WIFSIGNALED(status))
+    {
+        snprintf(message, 256, "decoder '%s' was terminated by signal %d", _decoder.c_str(), WTERMSIG(status));
+        return message;
+    }
+    return "";
+}
+
+
+ShmSource::ShmSource()
+{
+    _holding = false;
+    _frame_count = 0;
+    _data = NULL;
+    _number = 0;
+    _timestamp = 0;
+}
+
+ShmSource::~ShmSource()
+{
+    if (_holding)
+    {
+        _ring.release();
+    }
+}
+
+// Public
+// Attaches to the ring `name` (e.g. '/c2e-in'), which must hold cube faces
+bool ShmSource::open(std::string name)
+{
+    _name = "shm:" + name;
+    if (!_ring.open(name))
+    {
+        _error = "could not open shared memory ring '" + name + "'";
+        return false;
+    }
+    if (_ring.getFormat() != RING_FACES || _ring.getWidth() != _ring.getHeight())
+    {
+        _error = "shared memory ring '" + name + "' does not hold square cube faces";
+        return false;
+    }
+    return true;
+}
+
+const char* ShmSource::name()
+{
+    return _name.c_str();
+}
+
+// Hands the previous frame's slot back to the producer, then waits for the next one to be published
+bool ShmSource::hasMoreFrames()
+{
+    if (_data != NULL)
+    {
+        return true;
+    }
+    if (_holding)
+    {
+        _ring.release();
+        _holding = false;
+    }
+    if (!_ring.acquireRead(&_data, &_number, &_timestamp))
+    {
+        _data = NULL;
+        return false;
+    }
+    return true;
+}
+
+const SourceFrame& ShmSource::nextFrame()
+{
+    hasMoreFrames();
+    _holding = true;
+
+    int size = _ring.getWidth();
+    _frame.number = _frame_count++;
+    _frame.row_length = size;
+    _frame.timestamp_ns = _timestamp;
+    int i;
+    for (i = 0; i < 6; i++)
+    {
+        _frame.faces[i] = _data + (size_t)i * size * size * 4;
+        _frame.width[i] = size;
+        _frame.height[i] = size;
+    }
+    _data = NULL;
+    return _frame;
+}
+
+bool ShmSource::isFrameWaiting()
+{
+    return _ring.isFrameWaiting();
+}
+
+std::string ShmSource::getError()
+{
+    return _error;
+}
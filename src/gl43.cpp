@@ -0,0 +1,21 @@
+#include <cstddef>
+#include "glad/egl.h"
+#include "gl43.h"
+
+PFNGLDISPATCHCOMPUTEPROC gl43_glDispatchCompute = NULL;
+PFNGLMEMORYBARRIERPROC gl43_glMemoryBarrier = NULL;
+
+bool gl43LoadCompute()
+{
+    GLint major, minor;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major < 4 || (major == 4 && minor < 3))
+    {
+        return false;
+    }
+
+    gl43_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)eglGetProcAddress("glDispatchCompute");
+    gl43_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)eglGetProcAddress("glMemoryBarrier");
+    return gl43_glDispatchCompute != NULL && gl43_glMemoryBarrier != NULL;
+}
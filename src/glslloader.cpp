@@ -1,7 +1,8 @@
 #include "glslloader.h"
+#include "gl43.h"
 
 // Public
-GLuint glsl::createShaderProgram(const char *vert_filename, const char *frag_filename)
+GLuint glsl::createShaderProgram(const char *vert_filename, const char *frag_filename, const char *defines, const char *frag_library)
 {
     // Read vertex and fragment shaders from file
     char *vert_source, *frag_source;
@@ -13,9 +14,9 @@ GLuint glsl::createShaderProgram(const char *vert_filename, const char *frag_fil
     }
 
     // Compile vetex shader
-    GLuint vertex_shader = compileShader(vert_source, vert_length, GL_VERTEX_SHADER);
-    // Compile fragment shader
-    GLuint fragment_shader = compileShader(frag_source, frag_length, GL_FRAGMENT_SHADER);
+    GLuint vertex_shader = compileShader(vert_source, vert_length, defines, GL_VERTEX_SHADER);
+    // Compile fragment shader (with the shared library code, if any)
+    GLuint fragment_shader = compileShader(frag_source, frag_length, defines + readLibrary(frag_library), GL_FRAGMENT_SHADER);
 
     // Create GPU program from the compiled vertex and fragment shaders
     GLuint shaders[2] = {vertex_shader, fragment_shader};
@@ -24,8 +25,35 @@ GLuint glsl::createShaderProgram(const char *vert_filename, const char *frag_fil
     return program;
 }
 
-void glsl::linkShaderProgram(GLuint program)
+GLuint glsl::createComputeShaderProgram(const char *comp_filename, const char *defines, const char *library)
 {
+    // Read compute shader from file
+    char *comp_source;
+    int32_t comp_length = readFile(comp_filename, &comp_source);
+    if (comp_length < 0)
+    {
+        return 0;
+    }
+
+    // Compile compute shader (with the shared library code, if any)
+    GLuint compute_shader = compileShader(comp_source, comp_length, defines + readLibrary(library), GL_COMPUTE_SHADER);
+
+    // Create GPU program from the compiled compute shader
+    GLuint shaders[1] = {compute_shader};
+    GLuint program = attachShaders(shaders, 1);
+
+    return program;
+}
+
+bool glsl::linkShaderProgram(GLuint program)
+{
+    // A shader file could not be read
+    if (program == 0)
+    {
+        fprintf(stderr, "Error: failed to create shader program\n");
+        return false;
+    }
+
     // Link GPU program
     GLint status;
     glLinkProgram(program);
@@ -42,6 +70,7 @@ void glsl::linkShaderProgram(GLuint program)
         fprintf(stderr, "%s\n", info);
         delete[] info;
     }
+    return status != 0;
 }
 
 void glsl::getShaderProgramUniforms(GLuint program, std::map<std::string,GLint>& uniforms)
@@ -64,16 +93,25 @@ void glsl::getShaderProgramUniforms(GLuint program, std::map<std::string,GLint>&
 
 
 // Private
-GLint glsl::compileShader(char *source, int32_t length, GLenum type)
+GLint glsl::compileShader(char *source, int32_t length, std::string header, GLenum type)
 {
     // Create a shader object
     GLint status;
     GLuint shader = glCreateShader(type);
 
-    // Send the source to the shader object
-    const char *src_bytes = const_cast<const char*>(source);
-    const GLint len = length;
-    glShaderSource(shader, 1, &src_bytes, &len);
+    // Send the source to the shader object, with the header inserted after the '#version' line
+    int32_t version_length = 0;
+    while (version_length < length && source[version_length] != '\n')
+    {
+        version_length++;
+    }
+    if (version_length < length)
+    {
+        version_length++;
+    }
+    const char *src_bytes[3] = {const_cast<const char*>(source), header.c_str(), const_cast<const char*>(source) + version_length};
+    const GLint len[3] = {version_length, (GLint)header.length(), length - version_length};
+    glShaderSource(shader, 3, src_bytes, len);
 
     // Compile the shader program
     glCompileShader(shader);
@@ -126,10 +164,26 @@ std::string glsl::shaderTypeToString(GLenum type)
         case GL_FRAGMENT_SHADER:
             shader_type = "fragment";
             break;
+        case GL_COMPUTE_SHADER:
+            shader_type = "compute";
+            break;
     }
     return shader_type;
 }
 
+std::string glsl::readLibrary(const char *filename)
+{
+    std::string library = "";
+    char *source;
+    int32_t length = (filename != NULL) ? readFile(filename, &source) : -1;
+    if (length >= 0)
+    {
+        library = std::string(source, length) + "\n";
+        free(source);
+    }
+    return library;
+}
+
 int32_t glsl::readFile(const char* filename, char** data_ptr)
 {
     FILE *fp;
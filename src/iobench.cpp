@@ -0,0 +1,227 @@
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "asyncio.h"
+#include "iobench.h"
+
+// Scratch files standing in for a run's faces (16 frames of six 1 MB faces)
+#define BENCH_FILES 96
+#define BENCH_FILE_SIZE (1 << 20)
+#define BENCH_ROUNDS 3
+
+static double elapsedSince(std::chrono::steady_clock::time_point start);
+static std::string benchFilePath(const std::string& directory, int index);
+static void dropCache(const std::string& directory);
+static bool writeStdio(const std::string& directory, const std::vector<uint8_t>& data);
+static bool readStdio(const std::string& directory, std::vector<std::vector<uint8_t> >& buffers);
+static bool writeAsync(AsyncIO *io, const std::string& directory, const std::vector<uint8_t>& data);
+static bool readAsync(AsyncIO *io, const std::string& directory, std::vector<std::vector<uint8_t> >& buffers);
+
+// Writes and reads back a set of scratch files with stdio, the thread pool backend, and io_uring
+// (when available), printing the best of a few rounds for each. Reads start with the files evicted
+// from the page cache (which has no effect on tmpfs)
+bool runIoBenchmark(std::string directory, int num_threads)
+{
+    if (directory[directory.length() - 1] != '/') directory += "/";
+    mkdir(directory.c_str(), 0755);
+
+    std::vector<uint8_t> data(BENCH_FILE_SIZE);
+    size_t i;
+    for (i = 0; i < data.size(); i++)
+    {
+        data[i] = (uint8_t)(rand() & 0xFF);
+    }
+    std::vector<std::vector<uint8_t> > buffers(BENCH_FILES);
+
+    AsyncIO *backends[3];
+    backends[0] = NULL;
+    backends[1] = AsyncIO::create("threads", num_threads);
+    backends[2] = AsyncIO::create("uring", num_threads);
+    const char *names[3] = {"stdio", "thread pool", "io_uring"};
+    double total_mb = (double)BENCH_FILES * BENCH_FILE_SIZE / 1048576.0;
+
+    printf("I/O benchmark: %d files of %d KB in '%s' (%d threads for the thread pool)\n", BENCH_FILES, BENCH_FILE_SIZE >> 10,
+           directory.c_str(), num_threads);
+    bool ok = true;
+    int b;
+    for (b = 0; b < 3 && ok; b++)
+    {
+        if (b > 0 && backends[b] == NULL)
+        {
+            printf("  %-12s  not available\n", names[b]);
+            continue;
+        }
+
+        double write_ms = 0.0, read_ms = 0.0;
+        int round;
+        for (round = 0; round < BENCH_ROUNDS && ok; round++)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ok = (b == 0) ? writeStdio(directory, data) : writeAsync(backends[b], directory, data);
+            double ms = elapsedSince(start);
+            if (round == 0 || ms < write_ms) write_ms = ms;
+
+            sync();
+            dropCache(directory);
+            start = std::chrono::steady_clock::now();
+            ok = ok && ((b == 0) ? readStdio(directory, buffers) : readAsync(backends[b], directory, buffers));
+            ms = elapsedSince(start);
+            if (round == 0 || ms < read_ms) read_ms = ms;
+        }
+        printf("  %-12s  write %8.2f ms (%7.1f MB/s), read %8.2f ms (%7.1f MB/s)\n", names[b], write_ms, total_mb / (write_ms / 1000.0),
+               read_ms, total_mb / (read_ms / 1000.0));
+    }
+
+    for (i = 0; i < BENCH_FILES; i++)
+    {
+        unlink(benchFilePath(directory, i).c_str());
+    }
+    delete backends[1];
+    delete backends[2];
+    if (!ok)
+    {
+        fprintf(stderr, "Error: I/O benchmark could not write or read files in '%s'\n", directory.c_str());
+    }
+
+    return ok;
+}
+
+static double elapsedSince(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+static std::string benchFilePath(const std::string& directory, int index)
+{
+    char name[32];
+    snprintf(name, 32, "iobench_%03d.bin", index);
+    return directory + name;
+}
+
+static void dropCache(const std::string& directory)
+{
+    int i;
+    for (i = 0; i < BENCH_FILES; i++)
+    {
+        int fd = open(benchFilePath(directory, i).c_str(), O_RDONLY);
+        if (fd >= 0)
+        {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+static bool writeStdio(const std::string& directory, const std::vector<uint8_t>& data)
+{
+    int i;
+    for (i = 0; i < BENCH_FILES; i++)
+    {
+        FILE *fp = fopen(benchFilePath(directory, i).c_str(), "wb");
+        if (fp == NULL)
+        {
+            return false;
+        }
+        bool ok = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+        if (fclose(fp) != 0 || !ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool readStdio(const std::string& directory, std::vector<std::vector<uint8_t> >& buffers)
+{
+    int i;
+    for (i = 0; i < BENCH_FILES; i++)
+    {
+        FILE *fp = fopen(benchFilePath(directory, i).c_str(), "rb");
+        if (fp == NULL)
+        {
+            return false;
+        }
+        fseek(fp, 0, SEEK_END);
+        buffers[i].resize(ftell(fp));
+        fseek(fp, 0, SEEK_SET);
+        bool ok = (fread(buffers[i].data(), 1, buffers[i].size(), fp) == buffers[i].size());
+        fclose(fp);
+        if (!ok)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Opens every file, then submits all of the writes in one batch
+static bool writeAsync(AsyncIO *io, const std::string& directory, const std::vector<uint8_t>& data)
+{
+    std::vector<int> fds(BENCH_FILES, -1);
+    std::vector<IORequest> requests;
+    bool ok = true;
+    int i;
+    for (i = 0; i < BENCH_FILES && ok; i++)
+    {
+        fds[i] = open(benchFilePath(directory, i).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ok = (fds[i] >= 0);
+        IORequest request = {fds[i], (uint8_t*)data.data(), data.size(), 0, IO_WRITE, (void*)(intptr_t)i};
+        requests.push_back(request);
+    }
+    if (ok)
+    {
+        std::vector<IOCompletion> completions;
+        io->submit(requests);
+        io->wait(completions, requests.size());
+        for (i = 0; i < (int)completions.size(); i++)
+        {
+            if (completions[i].result != (int64_t)data.size()) ok = false;
+        }
+    }
+    for (i = 0; i < BENCH_FILES; i++)
+    {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+    return ok;
+}
+
+// Opens and sizes every file, then submits all of the reads in one batch
+static bool readAsync(AsyncIO *io, const std::string& directory, std::vector<std::vector<uint8_t> >& buffers)
+{
+    std::vector<int> fds(BENCH_FILES, -1);
+    std::vector<IORequest> requests;
+    bool ok = true;
+    int i;
+    for (i = 0; i < BENCH_FILES && ok; i++)
+    {
+        struct stat info;
+        fds[i] = open(benchFilePath(directory, i).c_str(), O_RDONLY);
+        ok = (fds[i] >= 0 && fstat(fds[i], &info) == 0);
+        if (ok)
+        {
+            buffers[i].resize(info.st_size);
+            IORequest request = {fds[i], buffers[i].data(), buffers[i].size(), 0, IO_READ, (void*)(intptr_t)i};
+            requests.push_back(request);
+        }
+    }
+    if (ok)
+    {
+        std::vector<IOCompletion> completions;
+        io->submit(requests);
+        io->wait(completions, requests.size());
+        for (i = 0; i < (int)completions.size(); i++)
+        {
+            if (completions[i].result != (int64_t)buffers[(intptr_t)completions[i].user].size()) ok = false;
+        }
+    }
+    for (i = 0; i < BENCH_FILES; i++)
+    {
+        if (fds[i] >= 0) close(fds[i]);
+    }
+    return ok;
+}
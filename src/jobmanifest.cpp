@@ -0,0 +1,384 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+#include "jobmanifest.h"
+
+static const char *JOB_FIELDS[4] = {"input", "output", "width", "format"};
+
+static bool isJobField(const std::string& name)
+{
+    return std::find(JOB_FIELDS, JOB_FIELDS + 4, name) != JOB_FIELDS + 4;
+}
+
+// Sets one field of `job` from its text (an empty value keeps the default)
+static bool setJobField(ConversionJob *job, std::string key, std::string value, std::string *error)
+{
+    if (key == "input")
+    {
+        job->input = value;
+    }
+    else if (key == "output")
+    {
+        job->output = value;
+    }
+    else if (key == "width")
+    {
+        char *end;
+        long width = strtol(value.c_str(), &end, 10);
+        if (!value.empty() && (*end != '\0' || width < 2))
+        {
+            *error = "invalid width '" + value + "'";
+            return false;
+        }
+        if (!value.empty()) job->width = (int)width;
+    }
+    else if (key == "format")
+    {
+        if (!value.empty()) job->format = value;
+    }
+    else
+    {
+        *error = "unknown field '" + key + "'";
+        return false;
+    }
+    return true;
+}
+
+static int lineAt(const std::string& text, size_t pos)
+{
+    int line = 1;
+    size_t i;
+    for (i = 0; i < pos && i < text.length(); i++)
+    {
+        if (text[i] == '\n') line++;
+    }
+    return line;
+}
+
+static void skipSpace(const std::string& text, size_t *pos)
+{
+    while (*pos < text.length() && isspace((unsigned char)text[*pos])) (*pos)++;
+}
+
+static void appendUtf8(std::string *out, unsigned int code)
+{
+    if (code < 0x80)
+    {
+        *out += (char)code;
+    }
+    else if (code < 0x800)
+    {
+        *out += (char)(0xC0 | (code >> 6));
+        *out += (char)(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        *out += (char)(0xE0 | (code >> 12));
+        *out += (char)(0x80 | ((code >> 6) & 0x3F));
+        *out += (char)(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        *out += (char)(0xF0 | (code >> 18));
+        *out += (char)(0x80 | ((code >> 12) & 0x3F));
+        *out += (char)(0x80 | ((code >> 6) & 0x3F));
+        *out += (char)(0x80 | (code & 0x3F));
+    }
+}
+
+// Parses the JSON string starting at the opening quote
+static bool parseJsonString(const std::string& text, size_t *pos, std::string *value)
+{
+    value->clear();
+    (*pos)++;
+    while (*pos < text.length())
+    {
+        char c = text[(*pos)++];
+        if (c == '"')
+        {
+            return true;
+        }
+        if (c != '\\')
+        {
+            *value += c;
+            continue;
+        }
+        if (*pos >= text.length()) return false;
+        c = text[(*pos)++];
+        if (c == 'n') *value += '\n';
+        else if (c == 't') *value += '\t';
+        else if (c == 'r') *value += '\r';
+        else if (c == 'b') *value += '\b';
+        else if (c == 'f') *value += '\f';
+        else if (c == '"' || c == '\\' || c == '/') *value += c;
+        else if (c == 'u' && *pos + 4 <= text.length())
+        {
+            unsigned int code = (unsigned int)strtoul(text.substr(*pos, 4).c_str(), NULL, 16);
+            *pos += 4;
+            // A surrogate pair encodes one character beyond the basic plane
+            if (code >= 0xD800 && code < 0xDC00 && text.compare(*pos, 2, "\\u") == 0 && *pos + 6 <= text.length())
+            {
+                unsigned int low = (unsigned int)strtoul(text.substr(*pos + 2, 4).c_str(), NULL, 16);
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                *pos += 6;
+            }
+            appendUtf8(value, code);
+        }
+        else return false;
+    }
+    return false;
+}
+
+// An array of flat objects whose values are strings, numbers, or null
+static bool parseJsonJobs(const std::string& text, const ConversionJob& defaults, std::vector<ConversionJob> *jobs, std::string *error)
+{
+    size_t pos = 0;
+    skipSpace(text, &pos);
+    pos++;
+    skipSpace(text, &pos);
+    if (pos < text.length() && text[pos] == ']')
+    {
+        return true;
+    }
+    while (pos < text.length())
+    {
+        if (text[pos] != '{')
+        {
+            *error = "expected an object on line " + std::to_string(lineAt(text, pos));
+            return false;
+        }
+        ConversionJob job = defaults;
+        pos++;
+        skipSpace(text, &pos);
+        while (pos < text.length() && text[pos] != '}')
+        {
+            std::string key, value;
+            if (text[pos] != '"' || !parseJsonString(text, &pos, &key))
+            {
+                *error = "expected a field name on line " + std::to_string(lineAt(text, pos));
+                return false;
+            }
+            skipSpace(text, &pos);
+            if (pos >= text.length() || text[pos] != ':')
+            {
+                *error = "expected ':' on line " + std::to_string(lineAt(text, pos));
+                return false;
+            }
+            pos++;
+            skipSpace(text, &pos);
+            size_t value_pos = pos;
+            if (pos < text.length() && text[pos] == '"')
+            {
+                if (!parseJsonString(text, &pos, &value))
+                {
+                    *error = "unterminated string on line " + std::to_string(lineAt(text, value_pos));
+                    return false;
+                }
+            }
+            else if (text.compare(pos, 4, "null") == 0)
+            {
+                pos += 4;
+            }
+            else
+            {
+                while (pos < text.length() && (isalnum((unsigned char)text[pos]) || text[pos] == '-' || text[pos] == '+' || text[pos] == '.')) pos++;
+                value = text.substr(value_pos, pos - value_pos);
+                if (value.empty())
+                {
+                    *error = "expected a value on line " + std::to_string(lineAt(text, value_pos));
+                    return false;
+                }
+            }
+            if (!setJobField(&job, key, value, error))
+            {
+                *error += " on line " + std::to_string(lineAt(text, value_pos));
+                return false;
+            }
+            skipSpace(text, &pos);
+            if (pos < text.length() && text[pos] == ',')
+            {
+                pos++;
+                skipSpace(text, &pos);
+            }
+            else if (pos < text.length() && text[pos] != '}')
+            {
+                *error = "expected ',' or '}' on line " + std::to_string(lineAt(text, pos));
+                return false;
+            }
+        }
+        if (pos >= text.length())
+        {
+            break;
+        }
+        jobs->push_back(job);
+        pos++;
+        skipSpace(text, &pos);
+        if (pos < text.length() && text[pos] == ']')
+        {
+            return true;
+        }
+        if (pos >= text.length() || text[pos] != ',')
+        {
+            *error = "expected ',' or ']' on line " + std::to_string(lineAt(text, pos));
+            return false;
+        }
+        pos++;
+        skipSpace(text, &pos);
+    }
+    *error = "unexpected end of file";
+    return false;
+}
+
+// Splits one CSV line into fields (double-quoted fields may contain commas, and '""' for a quote)
+static std::vector<std::string> splitCsvLine(const std::string& line)
+{
+    std::vector<std::string> fields;
+    std::string field;
+    bool quoted = false;
+    bool was_quoted = false;
+    size_t i;
+    for (i = 0; i <= line.length(); i++)
+    {
+        char c = (i < line.length()) ? line[i] : ',';
+        if (quoted && c == '"' && i + 1 < line.length() && line[i + 1] == '"')
+        {
+            field += '"';
+            i++;
+        }
+        else if (c == '"' && (quoted || field.find_first_not_of(" \t") == std::string::npos))
+        {
+            if (!quoted) field.clear();
+            quoted = !quoted;
+            was_quoted = true;
+        }
+        else if (c == ',' && !quoted)
+        {
+            // Unquoted fields are trimmed
+            if (!was_quoted)
+            {
+                size_t first = field.find_first_not_of(" \t");
+                size_t last = field.find_last_not_of(" \t");
+                field = (first == std::string::npos) ? "" : field.substr(first, last - first + 1);
+            }
+            fields.push_back(field);
+            field.clear();
+            was_quoted = false;
+        }
+        else if (!was_quoted || quoted)
+        {
+            field += c;
+        }
+    }
+    if (quoted)
+    {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+static bool parseCsvJobs(const std::string& text, const ConversionJob& defaults, std::vector<ConversionJob> *jobs, std::string *error)
+{
+    std::vector<std::string> columns(JOB_FIELDS, JOB_FIELDS + 4);
+    bool first = true;
+    int line_number = 0;
+    size_t start = 0;
+    while (start < text.length())
+    {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) end = text.length();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+        line_number++;
+        if (!line.empty() && line[line.length() - 1] == '\r') line.erase(line.length() - 1);
+        if (line.find_first_not_of(" \t") == std::string::npos || line[line.find_first_not_of(" \t")] == '#')
+        {
+            continue;
+        }
+
+        // A header line names the columns (in any order): every field is a field name, each named once,
+        // and the input and output are among them
+        std::vector<std::string> fields = splitCsvLine(line);
+        if (first && std::all_of(fields.begin(), fields.end(), isJobField))
+        {
+            size_t i;
+            for (i = 0; i < fields.size(); i++)
+            {
+                if (std::count(fields.begin(), fields.end(), fields[i]) > 1)
+                {
+                    *error = "column '" + fields[i] + "' appears more than once in the header on line " + std::to_string(line_number);
+                    return false;
+                }
+            }
+            if (std::count(fields.begin(), fields.end(), "input") == 0 || std::count(fields.begin(), fields.end(), "output") == 0)
+            {
+                *error = "the header on line " + std::to_string(line_number) + " needs 'input' and 'output' columns";
+                return false;
+            }
+            columns = fields;
+            first = false;
+            continue;
+        }
+        first = false;
+        if (fields.size() > columns.size())
+        {
+            *error = "too many fields on line " + std::to_string(line_number);
+            return false;
+        }
+        ConversionJob job = defaults;
+        size_t i;
+        for (i = 0; i < fields.size(); i++)
+        {
+            if (!setJobField(&job, columns[i], fields[i], error))
+            {
+                *error += " on line " + std::to_string(line_number);
+                return false;
+            }
+        }
+        jobs->push_back(job);
+    }
+    return true;
+}
+
+bool readJobManifest(std::string path, const ConversionJob& defaults, std::vector<ConversionJob> *jobs, std::string *error)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL)
+    {
+        *error = "could not open '" + path + "'";
+        return false;
+    }
+    std::string text;
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    {
+        text.append(buffer, count);
+    }
+    fclose(fp);
+
+    // JSON starts with '[', anything else is CSV
+    size_t pos = 0;
+    skipSpace(text, &pos);
+    bool ok = (pos < text.length() && text[pos] == '[') ? parseJsonJobs(text, defaults, jobs, error) : parseCsvJobs(text, defaults, jobs, error);
+    if (!ok)
+    {
+        return false;
+    }
+
+    size_t slash = path.find_last_of('/');
+    std::string base = (slash != std::string::npos) ? path.substr(0, slash + 1) : "";
+    size_t i;
+    for (i = 0; i < jobs->size(); i++)
+    {
+        ConversionJob& job = (*jobs)[i];
+        if (job.input.empty() || job.output.empty())
+        {
+            *error = "job " + std::to_string(i + 1) + " needs an input and an output";
+            return false;
+        }
+        if (job.input[0] != '/') job.input = base + job.input;
+        if (job.output[0] != '/') job.output = base + job.output;
+    }
+    return true;
+}
@@ -0,0 +1,295 @@
+#include <chrono>
+#include <sys/stat.h>
+#include "jobrunner.h"
+#include "outputcontainer.h"
+
+JobRunner::JobRunner()
+{
+    _stopping = false;
+}
+
+JobRunner::~JobRunner()
+{
+    stop();
+}
+
+// Public
+// Creates one OpenGL context per worker (on the default EGL display, already initialized), then
+// starts the workers
+bool JobRunner::start(int num_workers, C2EOptions options)
+{
+    _options = options;
+    _stopping = false;
+    int i;
+    for (i = 0; i < num_workers; i++)
+    {
+        RenderContext *context = new RenderContext();
+        if (!context->create(_options.pipeline == "compute"))
+        {
+            delete context;
+            return false;
+        }
+        _contexts.push_back(context);
+    }
+    _last_width.assign(num_workers, 0);
+    for (i = 0; i < num_workers; i++)
+    {
+        _workers.push_back(std::thread(&JobRunner::runWorker, this, i));
+    }
+    return true;
+}
+
+// Queues a job behind its user's and client's earlier jobs. A job that could not run (bad width or format, missing
+// input or output directory) is failed right away instead, with `error` set
+bool JobRunner::submit(ConversionJob *job)
+{
+    job->done = false;
+    job->ok = false;
+    job->frames = 0;
+    job->elapsed_ms = 0.0;
+    job->worker = -1;
+    job->warm = false;
+
+    // Jobs read face files; video, stdin, and shared memory inputs need a process of their own
+    struct stat info;
+    std::string error = "";
+    CubeLayout layout;
+    FrameIndex::findLayout(_options.layout, &layout);
+    if (job->width < 2)
+    {
+        error = "width must be at least 2";
+    }
+    else if (job->format != "" && job->format != "jpg" && job->format != "png")
+    {
+        error = "format must be 'jpg' or 'png'";
+    }
+    else if (stat(job->input.c_str(), &info) != 0 || (!S_ISDIR(info.st_mode) && !S_ISREG(info.st_mode)))
+    {
+        error = "input '" + job->input + "' is not a directory or archive";
+    }
+    else if (S_ISDIR(info.st_mode))
+    {
+        FrameIndex frames;
+        std::string dir = (job->input[job->input.length() - 1] != '/') ? job->input + "/" : job->input;
+        if (!frames.scan(dir, layout.columns > 0) || frames.size() == 0)
+        {
+            error = "cubemap images not found in '" + job->input + "'";
+        }
+    }
+    else
+    {
+        FaceArchive archive;
+        FrameIndex frames;
+        if (!archive.open(job->input))
+        {
+            error = "could not read '" + job->input + "' as a tar or zip archive";
+        }
+        else
+        {
+            frames.scanArchive(archive, job->input, layout.columns > 0);
+            if (frames.size() == 0) error = "cubemap images not found in '" + job->input + "'";
+        }
+    }
+    if (error.empty())
+    {
+        std::string output_dir = job->output;
+        if (OutputContainer::formatFromPath(job->output) != CONTAINER_NONE)
+        {
+            size_t slash = job->output.find_last_of('/');
+            output_dir = (slash != std::string::npos) ? job->output.substr(0, slash + 1) : "./";
+        }
+        if (stat(output_dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+        {
+            error = "output directory '" + output_dir + "' does not exist";
+        }
+    }
+    if (!error.empty())
+    {
+        finishJob(job, false, error);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_stopping)
+    {
+        job->done = true;
+        job->error = "shutting down";
+        return false;
+    }
+    _queues[job->user][job->client].push_back(job);
+    _job_queued.notify_one();
+    return true;
+}
+
+// Waits until `job` has finished
+void JobRunner::wait(ConversionJob *job)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!job->done)
+    {
+        _job_done.wait(lock);
+    }
+}
+
+// Lets the workers finish the jobs they are running, fails the jobs still queued, and destroys the
+// contexts
+void JobRunner::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        std::map<std::string,ClientQueues>::iterator user;
+        ClientQueues::iterator it;
+        for (user = _queues.begin(); user != _queues.end(); user++)
+        {
+            for (it = user->second.begin(); it != user->second.end(); it++)
+            {
+                while (!it->second.empty())
+                {
+                    it->second.front()->error = "shutting down";
+                    it->second.front()->done = true;
+                    it->second.pop_front();
+                }
+            }
+        }
+        _queues.clear();
+        _last_client.clear();
+        _passed_over.clear();
+        _job_queued.notify_all();
+        _job_done.notify_all();
+    }
+    size_t i;
+    for (i = 0; i < _workers.size(); i++)
+    {
+        _workers[i].join();
+    }
+    _workers.clear();
+    for (i = 0; i < _contexts.size(); i++)
+    {
+        delete _contexts[i];
+    }
+    _contexts.clear();
+}
+
+// Private
+// The cache lives on the worker's thread, as its GL objects can only be deleted with the context current
+void JobRunner::runWorker(int index)
+{
+    RenderCache *cache = new RenderCache();
+    ConversionJob *job;
+    while ((job = takeJob(index)) != NULL)
+    {
+        runJob(index, cache, job);
+    }
+    delete cache;
+    _contexts[index]->release();
+}
+
+// Takes a job of the user after the one served last, from that user's client after the one it was
+// served last (NULL once stopping)
+ConversionJob* JobRunner::takeJob(int index)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_queues.empty() && !_stopping)
+    {
+        _job_queued.wait(lock);
+    }
+    if (_stopping)
+    {
+        return NULL;
+    }
+    std::map<std::string,ClientQueues>::iterator user = _queues.upper_bound(_last_user);
+    if (user == _queues.end()) user = _queues.begin();
+    ClientQueues& clients = user->second;
+    ClientQueues::iterator it = clients.upper_bound(_last_client[user->first]);
+    if (it == clients.end()) it = clients.begin();
+    std::deque<ConversionJob*>& queue = it->second;
+    std::string queue_key = user->first + "\n" + it->first;
+    std::deque<ConversionJob*>::iterator pick = queue.begin();
+    if (_passed_over[queue_key] < MAX_PASSED_OVER)
+    {
+        std::deque<ConversionJob*>::iterator match;
+        for (match = queue.begin(); match != queue.end(); match++)
+        {
+            if ((*match)->width == _last_width[index])
+            {
+                pick = match;
+                break;
+            }
+        }
+    }
+    if (pick == queue.begin())
+    {
+        _passed_over[queue_key] = 0;
+    }
+    else
+    {
+        _passed_over[queue_key]++;
+    }
+    ConversionJob *job = *pick;
+    queue.erase(pick);
+    _last_user = user->first;
+    _last_client[user->first] = it->first;
+    _last_width[index] = job->width;
+    if (queue.empty())
+    {
+        _passed_over.erase(queue_key);
+        clients.erase(it);
+    }
+    if (clients.empty())
+    {
+        _last_client.erase(user->first);
+        _queues.erase(user);
+    }
+    return job;
+}
+
+void JobRunner::runJob(int index, RenderCache *cache, ConversionJob *job)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int height = job->width / 2;
+    if (!_contexts[index]->makeCurrent(job->width, height))
+    {
+        finishJob(job, false, "could not create a " + std::to_string(job->width) + "x" + std::to_string(height) + " render surface");
+        return;
+    }
+
+    // A conversion that cannot go on (e.g. an unreadable image) fails this job only
+    int64_t misses = cache->getMisses();
+    Cube2Equirect *converter = NULL;
+    int frames = 0;
+    try
+    {
+        converter = new Cube2Equirect(job->input, job->output, job->format, job->width, height, _options, cache);
+        while (converter->hasMoreFrames())
+        {
+            converter->renderNextFrame();
+            _contexts[index]->swapBuffers();
+            frames++;
+        }
+    }
+    catch (const C2EError& error)
+    {
+        delete converter;
+        job->frames = frames;
+        job->worker = index;
+        finishJob(job, false, error.what());
+        return;
+    }
+    delete converter;
+
+    job->frames = frames;
+    job->worker = index;
+    job->warm = (cache->getMisses() == misses);
+    job->elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    finishJob(job, true, "");
+}
+
+void JobRunner::finishJob(ConversionJob *job, bool ok, std::string error)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    job->ok = ok;
+    job->error = error;
+    job->done = true;
+    _job_done.notify_all();
+}
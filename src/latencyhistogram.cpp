@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cmath>
+#include "latencyhistogram.h"
+
+// 128 exact buckets, then 64 per power of two up to 2^47 us
+static const int SUB_BUCKET_BITS = 6;
+static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+static const int MAX_SHIFT = 40;
+
+LatencyHistogram::LatencyHistogram()
+{
+    _counts.assign(2 * SUB_BUCKETS + MAX_SHIFT * SUB_BUCKETS, 0);
+    _total = 0;
+    _max_us = 0;
+}
+
+LatencyHistogram::~LatencyHistogram()
+{
+}
+
+// Public
+void LatencyHistogram::record(double ms)
+{
+    int64_t us = std::max((int64_t)llround(ms * 1000.0), (int64_t)0);
+    _counts[bucketOf(us)]++;
+    _total++;
+    _max_us = std::max(_max_us, us);
+}
+
+int64_t LatencyHistogram::count()
+{
+    return _total;
+}
+
+// Value (in ms) that `p` percent of the recorded values are at or below, to within the bucket precision
+double LatencyHistogram::percentile(double p)
+{
+    if (_total == 0)
+    {
+        return 0.0;
+    }
+    int64_t rank = std::max((int64_t)ceil(p / 100.0 * _total), (int64_t)1);
+    int64_t seen = 0;
+    size_t i;
+    for (i = 0; i < _counts.size(); i++)
+    {
+        seen += _counts[i];
+        if (seen >= rank) break;
+    }
+    return std::min(highestValueIn((int)i), _max_us) / 1000.0;
+}
+
+double LatencyHistogram::max()
+{
+    return _max_us / 1000.0;
+}
+
+// Private
+int LatencyHistogram::bucketOf(int64_t us)
+{
+    if (us < 2 * SUB_BUCKETS)
+    {
+        return (int)us;
+    }
+    int shift = std::min(63 - __builtin_clzll((uint64_t)us) - SUB_BUCKET_BITS, MAX_SHIFT);
+    int64_t top = std::min(us >> shift, (int64_t)(2 * SUB_BUCKETS - 1));
+    return 2 * SUB_BUCKETS + (shift - 1) * SUB_BUCKETS + (int)(top - SUB_BUCKETS);
+}
+
+int64_t LatencyHistogram::highestValueIn(int bucket)
+{
+    if (bucket < 2 * SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    int shift = (bucket - 2 * SUB_BUCKETS) / SUB_BUCKETS + 1;
+    int64_t top = (bucket - 2 * SUB_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+    return ((top + 1) << shift) - 1;
+}
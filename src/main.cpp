@@ -1,12 +1,20 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cstdlib>
+#include <climits>
 #include <cstring>
 #include <string>
+#include <unistd.h>
 #include <sys/stat.h>
-#include "glad/egl.h"
-#include "glad/gl.h"
 
 #include "cube2equirect.h"
+#include "shardmanifest.h"
+#include "iobench.h"
+#include "latencyhistogram.h"
+#include "rendercontext.h"
+#include "daemon.h"
+#include "jobmanifest.h"
 
 
 typedef struct AppData {
@@ -16,134 +24,317 @@ typedef struct AppData {
     int height;                     // output image/video height
     std::string out_format;         // output file format
     int video_framerate;            // output video frame rate
-    EGLDisplay egl_display;         // EGL display
-    EGLSurface egl_surface;         // EGL surface
+    C2EOptions options;             // converter options
+    bool shard_manifest;            // write a manifest of the frames this shard converted
+    std::string merge_dir;          // directory of shard outputs to verify and encode (merge mode)
+    std::string benchmark_dir;      // scratch directory for the I/O benchmark (benchmark mode)
+    std::string daemon_socket;      // socket to accept conversion jobs on (daemon mode)
+    int num_workers;                // number of jobs converted at once, each with its own OpenGL context (daemon and batch modes)
+    std::string submit_socket;      // socket of the daemon to send the conversion to (client mode)
+    std::string client;             // name the daemon takes turns between among one user's jobs (client mode)
+    std::string batch_manifest;     // JSON or CSV list of conversions to run (batch mode)
 } AppData;
 
 
 void parseArguments(int argc, char **argv, AppData *app_ptr);
-void convertImageSequenceToVideo(std::string image_dir, std::string img_format, int image_framerate);
+void printFrameStats(const char *label, const C2EFrameStats& stats, int num_frames, int num_measured, int num_pixels);
+int mergeShards(AppData *app_ptr);
+int runBatch(AppData *app_ptr);
+bool convertImageSequenceToVideo(std::string image_dir, int image_framerate, const std::vector<std::string>& images);
+int run(int argc, char **argv);
 
 int main(int argc, char **argv) {
+    // A conversion that cannot go on ends the process (the daemon and batches fail just that job)
+    try {
+        return run(argc, argv);
+    }
+    catch (const C2EError& error) {
+        fprintf(stderr, "Error: %s\n", error.what());
+        return EXIT_FAILURE;
+    }
+}
+
+int run(int argc, char **argv) {
     if (argc < 3) {
         printf("\n");
         printf("  Usage: cube2equirect [options]\n");
         printf("\n");
         printf("  Options:\n");
         printf("\n");
-        printf("    -i, --input <DIRECTORY>      directory with cubemap image set sequence\n");
-        printf("    -o, --output <DIRECTORY>     directory to save equirectangular images [Default: \'output/\']\n");
+        printf("    -i, --input <DIRECTORY>      directory (or tar/zip archive) with cubemap image set sequence, cubemap video (see --decoder), \'-\' for raw faces on stdin, or \'shm:NAME\' for a shared memory ring\n");
+        printf("    -l, --layout <LAYOUT>        input frames as six face files (\'faces\'), or one image per frame packed as a horizontal \'cross\', \'3x2\', or \'6x1\' [Default: faces]\n");
+        printf("    -o, --output <DIRECTORY>     directory to save equirectangular images, or a \'.tar\' or \'.pack\' file to collect them in, \'-\' to stream them to stdout, or \'shm:NAME\' to publish them to a shared memory ring [Default: \'output/\']\n");
         printf("    -h, --h-resolution <NUMBER>  horizontal resolution of output images [Default: 3840]\n");
-        printf("    -f, --format <IMG_FORMAT>    output image format (\'jpg\', \'png\', or \'mp4\') [Default: same as input]\n");
+        printf("    -f, --format <IMG_FORMAT>    output image format (\'jpg\', \'png\', or \'mp4\'; or \'raw\' or \'y4m\' for stdout) [Default: same as input, y4m for stdout]\n");
         printf("    -r, --framerate <NUMBER>     number of images per second (for video output) [Default: 24]\n");
+        printf("    -p, --pipeline <PIPELINE>    GPU conversion pipeline (\'fragment\', \'compute\', \'remap\', or \'mesh\') [Default: fragment]\n");
+        printf("    -t, --mesh-density <NUMBER>  grid cells along each cube face edge for the mesh pipeline [Default: 32]\n");
+        printf("    -w, --workgroup <XxY>        compute pipeline workgroup size [Default: 8x8]\n");
+        printf("    -d, --decode <MODE>          face decoding (\'scaled\' to output needs, or \'full\' quality) [Default: scaled]\n");
+        printf("    -m, --mipmap <on|off>        filter minified regions using a mip chain for each face [Default: off]\n");
+        printf("    -a, --antialias <NUMBER>     max samples per axis where the mapping minifies or crosses a cube edge [Default: 1]\n");
+        printf("    -s, --stats <on|off>         print per-frame timing of each conversion stage [Default: off]\n");
+        printf("        --psnr <EVERY>           also measure PSNR against a supersampled reference on every EVERY-th rendered frame (0 for never; implies --stats on) [Default: 0]\n");
+        printf("        --start <NUMBER>         first frame number to convert [Default: 0]\n");
+        printf("        --end <NUMBER>           last frame number to convert [Default: last frame]\n");
+        printf("        --stride <NUMBER>        convert every Nth frame number, counting from the start frame [Default: 1]\n");
+        printf("        --shard <I/N>            convert block I (0-based) of N balanced blocks of the selected frames, and write a shard manifest\n");
+        printf("        --resume <on|off>        skip frames already converted with the same inputs and options [Default: off]\n");
+        printf("        --cache <on|off>         hash face contents to reuse outputs of identical frames and re-render only changed faces [Default: off]\n");
+        printf("        --dirty <on|off>         re-render only the output regions fed by faces that changed since the previous frame [Default: off]\n");
+        printf("        --prefetch <FRAMES>      number of upcoming frames to read ahead on I/O threads (0 to read on demand) [Default: 2]\n");
+        printf("        --io <BACKEND>           read-ahead I/O (\'uring\', \'threads\', or \'auto\' for io_uring when available) [Default: auto]\n");
+        printf("        --io-threads <NUMBER>    number of read-ahead threads for the \'threads\' backend [Default: 2]\n");
+        printf("        --prefetch-budget <MB>   max memory held by read-ahead [Default: 256]\n");
+        printf("        --write-queue <MB>       max memory held by encoded images waiting to be written in the background (0 to write synchronously) [Default: 64]\n");
+        printf("        --fsync <FILES>          flush written images to storage in batches of this many files (0 to leave it to the OS) [Default: 0]\n");
+        printf("        --decoder <COMMAND>      command decoding video input to RGBA frames on a pipe (ffmpeg, or one taking the same arguments) [Default: ffmpeg]\n");
+        printf("        --raw-size <WxH>         size of each raw face read from stdin [Default: read from a \'C2ERAW <W> <H>\' header line]\n");
+        printf("        --ring-slots <NUMBER>    number of frames held by a shared memory output ring [Default: 3]\n");
+        printf("        --watch <SECONDS>        keep converting frames as their faces are written to the input directory, until none arrive for SECONDS (0 for no limit)\n");
+        printf("        --watch-sentinel <NAME>  file whose appearance in the watched input directory ends the run [Default: DONE]\n");
+        printf("        --deadline <MS>          real-time mode: convert one frame at a time, dropping or degrading frames to keep latency within MS, and report latency percentiles\n");
+        printf("        --daemon <SOCKET>        keep OpenGL contexts, shader programs, and remap tables warm, converting jobs submitted to the Unix domain SOCKET\n");
+        printf("        --workers <NUMBER>       number of jobs the daemon (or a batch) converts at once [Default: 2]\n");
+        printf("        --submit <SOCKET>        send the conversion (-i, -o, -h, -f) to the daemon on SOCKET, and wait for it to finish\n");
+        printf("        --client <NAME>          name the daemon takes turns between among your own jobs (users always take turns) [Default: none]\n");
+        printf("        --batch <MANIFEST>       run every conversion listed in a JSON or CSV MANIFEST (input, output, width, format) in this process, on --workers workers\n");
+        printf("        --merge <DIRECTORY>      verify the shard manifests in DIRECTORY are complete, then encode video if format is \'mp4\'\n");
+        printf("        --io-benchmark <DIRECTORY>  compare stdio, thread pool, and io_uring file I/O on scratch files in DIRECTORY\n");
         printf("\n");
         return 0;
     }
 
     AppData app;
     parseArguments(argc, argv, &app);
+
+    // Frames streamed to stdout get the original descriptor, while everything printed goes to stderr
+    if (app.equirect_data_dir == "-")
+    {
+        app.options.output_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
     
     printf("-----------------\n| Cube2Equirect |\n-----------------\n");
 
+    if (!app.merge_dir.empty())
+    {
+        return mergeShards(&app);
+    }
+    if (!app.benchmark_dir.empty())
+    {
+        return runIoBenchmark(app.benchmark_dir, app.options.io_threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (!app.daemon_socket.empty())
+    {
+        return runDaemon(app.daemon_socket, app.num_workers, app.options);
+    }
+    if (!app.batch_manifest.empty())
+    {
+        return runBatch(&app);
+    }
+    if (!app.submit_socket.empty())
+    {
+        // The daemon resolves paths against its own working directory
+        char cwd[PATH_MAX];
+        std::string base = (getcwd(cwd, PATH_MAX) != NULL) ? std::string(cwd) + "/" : "";
+        ConversionJob job;
+        job.client = app.client;
+        job.input = (app.cube_data_dir[0] == '/') ? app.cube_data_dir : base + app.cube_data_dir;
+        job.output = (app.equirect_data_dir[0] == '/') ? app.equirect_data_dir : base + app.equirect_data_dir;
+        job.width = app.width;
+        job.format = app.out_format;
+        return submitJob(app.submit_socket, job);
+    }
+
+    // Video input is opened by the decoder (and may name six face videos), '-' is stdin, and 'shm:' a ring
     struct stat info;
-    if (stat(app.cube_data_dir.c_str(), &info) != 0) {
+    bool video_input = PipeSource::isVideoPath(app.cube_data_dir) || app.cube_data_dir == "-" || app.cube_data_dir.compare(0, 4, "shm:") == 0;
+    if (!video_input && stat(app.cube_data_dir.c_str(), &info) != 0) {
         fprintf(stderr, "\"%s\" does not exist or cannot be accessed, please specify directory with cubemap images\n", app.cube_data_dir.c_str());
         return EXIT_FAILURE;
     }
-    else if (!(info.st_mode & S_IFDIR)) {
-        fprintf(stderr, "\"%s\" is not a directory, please specify directory with cubemap images\n", app.cube_data_dir.c_str());
+    else if (!video_input && !S_ISDIR(info.st_mode) && !S_ISREG(info.st_mode)) {
+        fprintf(stderr, "\"%s\" is not a directory or archive, please specify directory (or tar/zip archive) with cubemap images\n", app.cube_data_dir.c_str());
         return EXIT_FAILURE;
     }
-    
-    // Prepare for EGL initialization
-    int egl_version = gladLoaderLoadEGL(NULL);
-    if (!egl_version)
-    {
-        fprintf(stderr, "Error: could not pre-initialize GLAD EGL\n");
+    else if (app.options.watch && (video_input || !S_ISDIR(info.st_mode))) {
+        fprintf(stderr, "\"%s\" is not a directory, only a directory of cubemap images can be watched\n", app.cube_data_dir.c_str());
         return EXIT_FAILURE;
     }
     
-    // Initialize EGL
-    app.egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    EGLint egl_major, egl_minor;
-    eglInitialize(app.egl_display, &egl_major, &egl_minor);
-    egl_version = gladLoaderLoadEGL(app.egl_display);
-    if (!egl_version)
-    {
-        fprintf(stderr, "Error: could not initialize EGL display\n");
+    // Initialize EGL, and create an OpenGL context rendering to a pbuffer of the output size
+    if (!RenderContext::initialize())
+    {
         return EXIT_FAILURE;
     }
-
-    // Initialize GL attributes
-    EGLint num_configs;
-    EGLConfig egl_config;
-    static const EGLint config_attribs[] = {
-        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
-        EGL_RED_SIZE, 8,
-        EGL_GREEN_SIZE, 8,
-        EGL_BLUE_SIZE, 8,
-        EGL_ALPHA_SIZE, 8,
-        EGL_DEPTH_SIZE, 24,
-        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
-        EGL_NONE
-    };
-    eglChooseConfig(app.egl_display, config_attribs, &egl_config, 1, &num_configs);
-
-    // Create EGL surface
-    static const EGLint pbuffer_attribs[] = {
-        EGL_WIDTH, app.width,
-        EGL_HEIGHT, app.height,
-        EGL_NONE
-    };
-    app.egl_surface = eglCreatePbufferSurface(app.egl_display, egl_config, pbuffer_attribs);
-
-    // Bind API
-    eglBindAPI(EGL_OPENGL_API);
-
-    // Create OpenGL context and make it current
-    static const EGLint context_attribs[] = {
-        EGL_CONTEXT_MAJOR_VERSION, 3,
-        EGL_CONTEXT_MINOR_VERSION, 3,
-        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
-        EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
-        EGL_NONE
-    };
-    EGLContext egl_ctx = eglCreateContext(app.egl_display, egl_config, EGL_NO_CONTEXT, context_attribs);
-    eglMakeCurrent(app.egl_display, app.egl_surface, app.egl_surface, egl_ctx);
-    
-    // Initialize GLAD (OpenGL Extenstions)
-    int ogl_version = gladLoaderLoadGL();
-    if (!ogl_version)
+    RenderContext *context = new RenderContext();
+    if (!context->create(app.options.pipeline == "compute") || !context->makeCurrent(app.width, app.height))
     {
-        fprintf(stderr, "Error: could not initialize GLAD OpenGL extensions\n");
+        fprintf(stderr, "Error: could not create an OpenGL context\n");
         return EXIT_FAILURE;
     }
-    
 
     const unsigned char* gl_version = glGetString(GL_VERSION);
     const unsigned char* glsl_version = glGetString(GL_SHADING_LANGUAGE_VERSION);
     printf("Using OpenGL %s, GLSL %s\n", gl_version, glsl_version);
 
     // Convert cube maps to equirectangular images    
-    Cube2Equirect *converter = new Cube2Equirect(app.cube_data_dir, app.equirect_data_dir, app.out_format, app.width, app.height);
+    Cube2Equirect *converter = new Cube2Equirect(app.cube_data_dir, app.equirect_data_dir, app.out_format, app.width, app.height, app.options);
+    C2EFrameStats total_stats = C2EFrameStats();
+    ShardManifest manifest = ShardManifest();
+    manifest.shard_index = app.options.shard_index;
+    manifest.shard_count = app.options.shard_count;
+    manifest.frame_start = app.options.frame_start;
+    manifest.frame_end = app.options.frame_end;
+    manifest.frame_stride = app.options.frame_stride;
+    manifest.range_frames = converter->getRangeFrameCount();
+    manifest.complete = false;
+    std::string shard_dir = app.equirect_data_dir;
+    if (shard_dir[shard_dir.length() - 1] != '/') shard_dir += "/";
+    // Written as incomplete up front, so a merge can tell a shard that started but never finished
+    if (app.shard_manifest && !writeShardManifest(shard_dir, manifest))
+    {
+        fprintf(stderr, "Error: could not write shard manifest to '%s'\n", shard_dir.c_str());
+        return EXIT_FAILURE;
+    }
+    int num_frames = 0;
+    int num_skipped = 0;
+    double max_latency_ms = 0.0;
+    int num_dropped = 0;
+    int num_degraded = 0;
+    int num_measured = 0;
+    LatencyHistogram stage_latency[7];
     while (converter->hasMoreFrames()) {
         converter->renderNextFrame();
-        eglSwapBuffers(app.egl_display, app.egl_surface);
+        context->swapBuffers();
+
+        // The image may still be queued for writing, so its size is taken at the end
+        if (app.shard_manifest)
+        {
+            std::string path = converter->getOutputFiles().back();
+            ShardFrame frame;
+            frame.number = converter->getFrameStats().frame;
+            frame.file = path.substr(path.rfind('/') + 1);
+            frame.size = -1;
+            manifest.frames.push_back(frame);
+        }
+
+        if (converter->getFrameStats().skipped)
+        {
+            const C2EFrameStats& stats = converter->getFrameStats();
+            if (app.options.stats && stats.reused_from >= 0 && stats.reused_from != stats.frame)
+            {
+                printf("frame %06d: identical to frame %06d, output reused\n", stats.frame, stats.reused_from);
+            }
+            else if (app.options.stats)
+            {
+                printf("frame %06d: up to date, skipped\n", stats.frame);
+            }
+            num_skipped++;
+        }
+        else if (app.options.stats || app.options.deadline_ms > 0.0)
+        {
+            const C2EFrameStats& stats = converter->getFrameStats();
+            char label[48];
+            if (stats.faces_rendered < 6) snprintf(label, 48, "frame %06d (%d faces re-rendered)", stats.frame, stats.faces_rendered);
+            else if (stats.dirty_regions >= 0) snprintf(label, 48, "frame %06d (%d regions updated)", stats.frame, stats.dirty_regions);
+            else if (stats.degrade_level > 0) snprintf(label, 48, "frame %06d (degraded to level %d)", stats.frame, stats.degrade_level);
+            else snprintf(label, 48, "frame %06d", stats.frame);
+            if (app.options.stats) printFrameStats(label, stats, 1, (stats.psnr_db > 0.0) ? 1 : 0, app.width * app.height);
+            double stage_ms[7] = {stats.decode_ms, stats.upload_ms, stats.convert_ms, stats.readback_ms, stats.encode_ms,
+                                  stats.decode_ms + stats.upload_ms + stats.convert_ms + stats.readback_ms + stats.encode_ms, stats.latency_ms};
+            int i;
+            for (i = 0; i < 7; i++)
+            {
+                stage_latency[i].record(stage_ms[i]);
+            }
+            num_dropped += stats.dropped_frames;
+            if (stats.degrade_level > 0) num_degraded++;
+            total_stats.decode_ms += stats.decode_ms;
+            total_stats.upload_ms += stats.upload_ms;
+            total_stats.convert_ms += stats.convert_ms;
+            total_stats.readback_ms += stats.readback_ms;
+            total_stats.encode_ms += stats.encode_ms;
+            total_stats.latency_ms += stats.latency_ms;
+            max_latency_ms = std::max(max_latency_ms, stats.latency_ms);
+            total_stats.samples += stats.samples;
+            total_stats.faces_refreshed += stats.faces_refreshed;
+            total_stats.psnr_db += stats.psnr_db;
+            if (stats.psnr_db > 0.0) num_measured++;
+        }
+        num_frames++;
+    }
+    if (app.options.stats && num_frames > num_skipped)
+    {
+        printFrameStats("average", total_stats, num_frames - num_skipped, num_measured, app.width * app.height);
+        printf("latency: %.2f ms average, %.2f ms max\n", total_stats.latency_ms / (num_frames - num_skipped), max_latency_ms);
+    }
+    if (app.options.deadline_ms > 0.0)
+    {
+        printf("real-time (%.1f ms deadline): %d frames converted, %d degraded, %d dropped\n", app.options.deadline_ms, num_frames - num_skipped, num_degraded, num_dropped);
+    }
+    if ((app.options.stats || app.options.deadline_ms > 0.0) && num_frames > num_skipped)
+    {
+        static const char *stage_names[7] = {"decode", "upload", "convert", "readback", "encode", "total", "latency"};
+        int i;
+        for (i = 0; i < 7; i++)
+        {
+            printf("%-8s p50 %8.2f ms, p99 %8.2f ms, p99.9 %8.2f ms, max %8.2f ms\n", stage_names[i], stage_latency[i].percentile(50.0),
+                   stage_latency[i].percentile(99.0), stage_latency[i].percentile(99.9), stage_latency[i].max());
+        }
+    }
+    if (app.options.stats && app.options.prefetch_frames > 0)
+    {
+        PrefetchStats prefetch = converter->getPrefetchStats();
+        printf("read-ahead (%s): %lld hits, %lld stalls (%.2f ms waiting), %lld misses, %.1f MB read\n", converter->getPrefetchBackend(), (long long)prefetch.hits,
+               (long long)prefetch.stalls, prefetch.stall_ms, (long long)prefetch.misses, prefetch.bytes_read / 1048576.0);
+    }
+    if (app.options.stats)
+    {
+        WriterStats writer = converter->getWriterStats();
+        printf("write-behind (%s): %lld files, %.1f MB written, %lld stalls (%.2f ms waiting), %lld sync batches\n", converter->getWriterBackend(),
+               (long long)writer.files, writer.bytes / 1048576.0, (long long)writer.stalls, writer.stall_ms, (long long)writer.sync_batches);
+    }
+    if (app.options.resume || app.options.cache)
+    {
+        printf("Converted %d frames, %d already up to date\n", num_frames - num_skipped, num_skipped);
     }
     
-    // Compile image sequence to video (if desired)
-    if (app.out_format == "mp4")
+    if (app.shard_manifest)
     {
-        convertImageSequenceToVideo(app.equirect_data_dir, converter->getEquirectImageFormat(), app.video_framerate);
+        // Converting the last frame waited for every write, so the images are in place
+        size_t i;
+        for (i = 0; i < manifest.frames.size(); i++)
+        {
+            struct stat out_info;
+            std::string path = shard_dir + manifest.frames[i].file;
+            manifest.frames[i].size = (stat(path.c_str(), &out_info) == 0) ? out_info.st_size : -1;
+        }
+        manifest.complete = true;
+        if (!writeShardManifest(shard_dir, manifest))
+        {
+            fprintf(stderr, "Error: could not write shard manifest to '%s'\n", shard_dir.c_str());
+            return EXIT_FAILURE;
+        }
+        printf("Shard %d/%d: converted %d of %d frames\n", manifest.shard_index, manifest.shard_count, num_frames, (int)manifest.range_frames);
+    }
+    
+    // Compile image sequence to video (if desired); shards leave that to the merge step
+    if (app.out_format == "mp4" && app.shard_manifest)
+    {
+        printf("Run with '--merge %s' once all shards finish to encode the video\n", app.equirect_data_dir.c_str());
+    }
+    else if (app.out_format == "mp4")
+    {
+        convertImageSequenceToVideo(app.equirect_data_dir, app.video_framerate, converter->getOutputFiles());
     }
 
     // Clean up
     delete converter;
-    gladLoaderUnloadGL();
-    eglDestroyContext(app.egl_display, egl_ctx);
-    eglDestroySurface(app.egl_display, app.egl_surface);
-    eglTerminate(app.egl_display);
-    gladLoaderUnloadEGL();
+    context->release();
+    delete context;
+    RenderContext::terminate();
 
 
     return EXIT_SUCCESS;
@@ -155,6 +346,47 @@ void parseArguments(int argc, char **argv, AppData *app_ptr) {
     app_ptr->height = app_ptr->width / 2;
     app_ptr->out_format = "";
     app_ptr->video_framerate = 24;
+    app_ptr->options.layout = "faces";
+    app_ptr->options.pipeline = "fragment";
+    app_ptr->options.workgroup_size[0] = 8;
+    app_ptr->options.workgroup_size[1] = 8;
+    app_ptr->options.mesh_density = 32;
+    app_ptr->options.scaled_decode = true;
+    app_ptr->options.mipmaps = false;
+    app_ptr->options.antialias = 1;
+    app_ptr->options.stats = false;
+    app_ptr->options.frame_start = 0;
+    app_ptr->options.frame_end = -1;
+    app_ptr->options.frame_stride = 1;
+    app_ptr->options.shard_index = 0;
+    app_ptr->options.shard_count = 1;
+    app_ptr->options.resume = false;
+    app_ptr->options.cache = false;
+    app_ptr->options.dirty = false;
+    app_ptr->options.prefetch_frames = 2;
+    app_ptr->options.io_backend = "auto";
+    app_ptr->options.io_threads = 2;
+    app_ptr->options.prefetch_budget = 256 << 20;
+    app_ptr->options.write_budget = 64 << 20;
+    app_ptr->options.sync_batch = 0;
+    app_ptr->options.decoder = "ffmpeg";
+    app_ptr->options.raw_face_size[0] = 0;
+    app_ptr->options.raw_face_size[1] = 0;
+    app_ptr->options.output_fd = -1;
+    app_ptr->options.ring_slots = 3;
+    app_ptr->options.watch = false;
+    app_ptr->options.watch_idle_ms = 0;
+    app_ptr->options.watch_sentinel = "DONE";
+    app_ptr->options.deadline_ms = 0.0;
+    app_ptr->options.psnr_interval = 0;
+    app_ptr->shard_manifest = false;
+    app_ptr->merge_dir = "";
+    app_ptr->benchmark_dir = "";
+    app_ptr->daemon_socket = "";
+    app_ptr->num_workers = 2;
+    app_ptr->submit_socket = "";
+    app_ptr->client = "";
+    app_ptr->batch_manifest = "";
     bool has_input = false;
 
     int arg_idx = 1;
@@ -165,6 +397,10 @@ void parseArguments(int argc, char **argv, AppData *app_ptr) {
             app_ptr->cube_data_dir = argv[arg_idx + 1];    
             has_input = true;
         }
+        else if (strcmp(argv[arg_idx], "-l") == 0 || strcmp(argv[arg_idx], "--layout") == 0)
+        {
+            app_ptr->options.layout = argv[arg_idx + 1];
+        }
         else if (strcmp(argv[arg_idx], "-o") == 0 || strcmp(argv[arg_idx], "--output") == 0)
         {
             app_ptr->equirect_data_dir = argv[arg_idx + 1];
@@ -190,17 +426,516 @@ void parseArguments(int argc, char **argv, AppData *app_ptr) {
                 app_ptr->video_framerate = fr;
             }
         }
+        else if (strcmp(argv[arg_idx], "-p") == 0 || strcmp(argv[arg_idx], "--pipeline") == 0)
+        {
+            app_ptr->options.pipeline = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "-w") == 0 || strcmp(argv[arg_idx], "--workgroup") == 0)
+        {
+            // Sizes beyond the GPU's limits are rejected once the context exists
+            int wg_x, wg_y;
+            if (sscanf(argv[arg_idx + 1], "%dx%d", &wg_x, &wg_y) != 2 || wg_x <= 0 || wg_y <= 0)
+            {
+                fprintf(stderr, "invalid workgroup size \'%s\', please specify XxY\n", argv[arg_idx + 1]);
+                exit(EXIT_FAILURE);
+            }
+            app_ptr->options.workgroup_size[0] = wg_x;
+            app_ptr->options.workgroup_size[1] = wg_y;
+        }
+        else if (strcmp(argv[arg_idx], "-t") == 0 || strcmp(argv[arg_idx], "--mesh-density") == 0)
+        {
+            int density = atoi(argv[arg_idx + 1]);
+            if (density > 0)
+            {
+                app_ptr->options.mesh_density = density;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "-d") == 0 || strcmp(argv[arg_idx], "--decode") == 0)
+        {
+            app_ptr->options.scaled_decode = (strcmp(argv[arg_idx + 1], "full") != 0);
+        }
+        else if (strcmp(argv[arg_idx], "-m") == 0 || strcmp(argv[arg_idx], "--mipmap") == 0)
+        {
+            app_ptr->options.mipmaps = (strcmp(argv[arg_idx + 1], "on") == 0);
+        }
+        else if (strcmp(argv[arg_idx], "-a") == 0 || strcmp(argv[arg_idx], "--antialias") == 0)
+        {
+            int samples = atoi(argv[arg_idx + 1]);
+            if (samples > 0)
+            {
+                app_ptr->options.antialias = samples;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "-s") == 0 || strcmp(argv[arg_idx], "--stats") == 0)
+        {
+            app_ptr->options.stats = (strcmp(argv[arg_idx + 1], "on") == 0);
+        }
+        else if (strcmp(argv[arg_idx], "--psnr") == 0)
+        {
+            int interval = atoi(argv[arg_idx + 1]);
+            if (interval >= 0)
+            {
+                app_ptr->options.psnr_interval = interval;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--start") == 0)
+        {
+            int start = atoi(argv[arg_idx + 1]);
+            if (start >= 0)
+            {
+                app_ptr->options.frame_start = start;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--end") == 0)
+        {
+            int end = atoi(argv[arg_idx + 1]);
+            if (end >= 0)
+            {
+                app_ptr->options.frame_end = end;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--stride") == 0)
+        {
+            int stride = atoi(argv[arg_idx + 1]);
+            if (stride > 0)
+            {
+                app_ptr->options.frame_stride = stride;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--shard") == 0)
+        {
+            int index, count;
+            if (sscanf(argv[arg_idx + 1], "%d/%d", &index, &count) != 2 || count < 1 || index < 0 || index >= count)
+            {
+                fprintf(stderr, "invalid shard \'%s\', please specify I/N with 0 <= I < N\n", argv[arg_idx + 1]);
+                exit(EXIT_FAILURE);
+            }
+            app_ptr->options.shard_index = index;
+            app_ptr->options.shard_count = count;
+            app_ptr->shard_manifest = true;
+        }
+        else if (strcmp(argv[arg_idx], "--resume") == 0)
+        {
+            app_ptr->options.resume = (strcmp(argv[arg_idx + 1], "on") == 0);
+        }
+        else if (strcmp(argv[arg_idx], "--cache") == 0)
+        {
+            app_ptr->options.cache = (strcmp(argv[arg_idx + 1], "on") == 0);
+        }
+        else if (strcmp(argv[arg_idx], "--dirty") == 0)
+        {
+            app_ptr->options.dirty = (strcmp(argv[arg_idx + 1], "on") == 0);
+        }
+        else if (strcmp(argv[arg_idx], "--prefetch") == 0)
+        {
+            int frames = atoi(argv[arg_idx + 1]);
+            if (frames >= 0)
+            {
+                app_ptr->options.prefetch_frames = frames;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--io") == 0)
+        {
+            app_ptr->options.io_backend = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--io-threads") == 0)
+        {
+            int threads = atoi(argv[arg_idx + 1]);
+            if (threads > 0)
+            {
+                app_ptr->options.io_threads = threads;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--prefetch-budget") == 0)
+        {
+            int megabytes = atoi(argv[arg_idx + 1]);
+            if (megabytes > 0)
+            {
+                app_ptr->options.prefetch_budget = (int64_t)megabytes << 20;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--write-queue") == 0)
+        {
+            int megabytes = atoi(argv[arg_idx + 1]);
+            if (megabytes >= 0)
+            {
+                app_ptr->options.write_budget = (int64_t)megabytes << 20;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--fsync") == 0)
+        {
+            int files = atoi(argv[arg_idx + 1]);
+            if (files >= 0)
+            {
+                app_ptr->options.sync_batch = files;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--decoder") == 0)
+        {
+            app_ptr->options.decoder = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--raw-size") == 0)
+        {
+            int raw_w, raw_h;
+            if (sscanf(argv[arg_idx + 1], "%dx%d", &raw_w, &raw_h) != 2 || raw_w <= 0 || raw_h <= 0)
+            {
+                fprintf(stderr, "invalid raw face size \'%s\', please specify WxH\n", argv[arg_idx + 1]);
+                exit(EXIT_FAILURE);
+            }
+            app_ptr->options.raw_face_size[0] = raw_w;
+            app_ptr->options.raw_face_size[1] = raw_h;
+        }
+        else if (strcmp(argv[arg_idx], "--ring-slots") == 0)
+        {
+            int slots = atoi(argv[arg_idx + 1]);
+            if (slots > 0)
+            {
+                app_ptr->options.ring_slots = slots;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--watch") == 0)
+        {
+            double seconds = atof(argv[arg_idx + 1]);
+            if (seconds >= 0.0)
+            {
+                app_ptr->options.watch = true;
+                app_ptr->options.watch_idle_ms = (int)(seconds * 1000.0);
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--watch-sentinel") == 0)
+        {
+            app_ptr->options.watch_sentinel = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--deadline") == 0)
+        {
+            double deadline = atof(argv[arg_idx + 1]);
+            if (deadline > 0.0)
+            {
+                app_ptr->options.deadline_ms = deadline;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--daemon") == 0)
+        {
+            app_ptr->daemon_socket = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--workers") == 0)
+        {
+            int workers = atoi(argv[arg_idx + 1]);
+            if (workers > 0)
+            {
+                app_ptr->num_workers = workers;
+            }
+        }
+        else if (strcmp(argv[arg_idx], "--submit") == 0)
+        {
+            app_ptr->submit_socket = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--client") == 0)
+        {
+            app_ptr->client = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--batch") == 0)
+        {
+            app_ptr->batch_manifest = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--merge") == 0)
+        {
+            app_ptr->merge_dir = argv[arg_idx + 1];
+        }
+        else if (strcmp(argv[arg_idx], "--io-benchmark") == 0)
+        {
+            app_ptr->benchmark_dir = argv[arg_idx + 1];
+        }
         arg_idx += 2;
     }
 
-    if (!has_input) {
+    app_ptr->options.framerate = app_ptr->video_framerate;
+    // PSNR is reported per millisecond of the timed stages
+    if (app_ptr->options.psnr_interval > 0) app_ptr->options.stats = true;
+
+    if (app_ptr->options.pipeline != "fragment" && app_ptr->options.pipeline != "compute" && app_ptr->options.pipeline != "remap" && app_ptr->options.pipeline != "mesh") {
+        fprintf(stderr, "unknown pipeline \'%s\', please specify \'fragment\', \'compute\', \'remap\', or \'mesh\'\n", app_ptr->options.pipeline.c_str());
+        exit(EXIT_FAILURE);
+    }
+    CubeLayout layout;
+    if (!FrameIndex::findLayout(app_ptr->options.layout, &layout)) {
+        fprintf(stderr, "unknown layout \'%s\', please specify \'faces\', \'cross\', \'3x2\', or \'6x1\'\n", app_ptr->options.layout.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (app_ptr->options.io_backend != "auto" && app_ptr->options.io_backend != "uring" && app_ptr->options.io_backend != "threads") {
+        fprintf(stderr, "unknown I/O backend \'%s\', please specify \'auto\', \'uring\', or \'threads\'\n", app_ptr->options.io_backend.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (OutputContainer::formatFromPath(app_ptr->equirect_data_dir) != CONTAINER_NONE &&
+        (app_ptr->out_format == "mp4" || app_ptr->options.resume || app_ptr->options.cache || app_ptr->shard_manifest || !app_ptr->merge_dir.empty())) {
+        fprintf(stderr, "a container output (\'.tar\' or \'.pack\') cannot be combined with mp4, --resume, --cache, --shard, or --merge\n");
+        exit(EXIT_FAILURE);
+    }
+    if (has_input && (PipeSource::isVideoPath(app_ptr->cube_data_dir) || app_ptr->cube_data_dir == "-" || app_ptr->cube_data_dir.compare(0, 4, "shm:") == 0)) {
+        if (app_ptr->options.resume || app_ptr->options.cache || app_ptr->shard_manifest) {
+            fprintf(stderr, "video, stdin, or shared memory input cannot be combined with --resume, --cache, or --shard\n");
+            exit(EXIT_FAILURE);
+        }
+        // Read-ahead is for face files
+        app_ptr->options.prefetch_frames = 0;
+    }
+    if (app_ptr->equirect_data_dir == "-" &&
+        (app_ptr->out_format == "mp4" || app_ptr->options.resume || app_ptr->options.cache || app_ptr->shard_manifest || !app_ptr->merge_dir.empty())) {
+        fprintf(stderr, "a stdout output (\'-\') cannot be combined with mp4, --resume, --cache, --shard, or --merge\n");
+        exit(EXIT_FAILURE);
+    }
+    bool ring_output = (app_ptr->equirect_data_dir.compare(0, 4, "shm:") == 0);
+    if (ring_output && ((app_ptr->out_format != "" && app_ptr->out_format != "raw") || app_ptr->options.resume || app_ptr->options.cache ||
+                        app_ptr->shard_manifest || !app_ptr->merge_dir.empty())) {
+        fprintf(stderr, "a shared memory output (\'shm:NAME\') holds raw images, and cannot be combined with --resume, --cache, --shard, or --merge\n");
+        exit(EXIT_FAILURE);
+    }
+    if (app_ptr->equirect_data_dir != "-" && !ring_output && (app_ptr->out_format == "raw" || app_ptr->out_format == "y4m")) {
+        fprintf(stderr, "\'raw\' and \'y4m\' output formats are only written to stdout (\'-o -\') or shared memory (\'-o shm:NAME\')\n");
+        exit(EXIT_FAILURE);
+    }
+    if (app_ptr->options.deadline_ms > 0.0 && (app_ptr->options.resume || app_ptr->options.cache)) {
+        // Degraded frames would be recorded as finished and never converted at full quality
+        fprintf(stderr, "--deadline cannot be combined with --resume or --cache\n");
+        exit(EXIT_FAILURE);
+    }
+    if (app_ptr->options.deadline_ms > 0.0) {
+        // Real-time mode keeps at most one frame in flight on each side of conversion
+        app_ptr->options.prefetch_frames = std::min(app_ptr->options.prefetch_frames, 1);
+        app_ptr->options.write_budget = 0;
+    }
+    if (app_ptr->options.watch && app_ptr->shard_manifest) {
+        fprintf(stderr, "--watch cannot be combined with --shard\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((!app_ptr->daemon_socket.empty() || !app_ptr->batch_manifest.empty()) &&
+        (app_ptr->options.watch || app_ptr->shard_manifest || app_ptr->options.deadline_ms > 0.0)) {
+        fprintf(stderr, "--daemon and --batch cannot be combined with --watch, --shard, or --deadline\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((!app_ptr->submit_socket.empty() || !app_ptr->batch_manifest.empty()) && (app_ptr->out_format != "" && app_ptr->out_format != "jpg" && app_ptr->out_format != "png")) {
+        fprintf(stderr, "the daemon and batches write \'jpg\' or \'png\' images\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!has_input && app_ptr->merge_dir.empty() && app_ptr->benchmark_dir.empty() && app_ptr->daemon_socket.empty() && app_ptr->batch_manifest.empty()) {
         fprintf(stderr, "please specify an input directory with cubemap images\n");
         exit(EXIT_FAILURE);
     }
 }
 
-void convertImageSequenceToVideo(std::string image_dir, std::string img_format, int image_framerate)
+void printFrameStats(const char *label, const C2EFrameStats& stats, int num_frames, int num_measured, int num_pixels)
+{
+    double total_ms = stats.decode_ms + stats.upload_ms + stats.convert_ms + stats.readback_ms + stats.encode_ms;
+    double samples = (double)stats.samples / num_frames;
+    printf("%s: decode %.2f ms, upload %.2f ms, convert %.2f ms, readback %.2f ms, encode %.2f ms (total %.2f ms), latency %.2f ms, %.0f samples (%.2f/px), %.1f faces refreshed\n",
+           label, stats.decode_ms / num_frames, stats.upload_ms / num_frames, stats.convert_ms / num_frames,
+           stats.readback_ms / num_frames, stats.encode_ms / num_frames, total_ms / num_frames, stats.latency_ms / num_frames,
+           samples, samples / num_pixels, (double)stats.faces_refreshed / num_frames);
+
+    // Quality per millisecond of processing, to weigh filtering options against their cost (averaged
+    // over the frames whose PSNR was measured)
+    if (num_measured > 0)
+    {
+        double psnr_db = stats.psnr_db / num_measured;
+        printf("%s: PSNR %.2f dB against a 4x4 supersampled reference, %.3f dB/ms\n", label, psnr_db, psnr_db / std::max(total_ms / num_frames, 0.001));
+    }
+}
+
+// Runs every conversion in the batch manifest on a pool of workers, which keep their OpenGL contexts
+// and set-up GL objects from one job to the next. Jobs leaving out the width or format take -h and -f
+int runBatch(AppData *app_ptr)
+{
+    ConversionJob defaults;
+    defaults.width = app_ptr->width;
+    defaults.format = app_ptr->out_format;
+    std::vector<ConversionJob> jobs;
+    std::string error;
+    if (!readJobManifest(app_ptr->batch_manifest, defaults, &jobs, &error))
+    {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return EXIT_FAILURE;
+    }
+    if (!RenderContext::initialize())
+    {
+        return EXIT_FAILURE;
+    }
+    JobRunner *runner = new JobRunner();
+    int num_workers = std::max(1, std::min(app_ptr->num_workers, (int)jobs.size()));
+    if (!runner->start(num_workers, app_ptr->options))
+    {
+        fprintf(stderr, "Error: could not create an OpenGL context for each worker\n");
+        return EXIT_FAILURE;
+    }
+    printf("Running %d jobs on %d workers\n", (int)jobs.size(), num_workers);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t i;
+    for (i = 0; i < jobs.size(); i++)
+    {
+        runner->submit(&jobs[i]);
+    }
+    int num_failed = 0;
+    int num_warm = 0;
+    int num_frames = 0;
+    for (i = 0; i < jobs.size(); i++)
+    {
+        runner->wait(&jobs[i]);
+        if (jobs[i].ok)
+        {
+            printf("job %d: %s -> %s, %d frames in %.1f ms on worker %d%s\n", (int)i + 1, jobs[i].input.c_str(), jobs[i].output.c_str(),
+                   jobs[i].frames, jobs[i].elapsed_ms, jobs[i].worker, jobs[i].warm ? " (warm)" : "");
+            num_frames += jobs[i].frames;
+            if (jobs[i].warm) num_warm++;
+        }
+        else
+        {
+            fprintf(stderr, "job %d: %s -> %s failed: %s\n", (int)i + 1, jobs[i].input.c_str(), jobs[i].output.c_str(), jobs[i].error.c_str());
+            num_failed++;
+        }
+    }
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Converted %d of %d jobs (%d frames, %d on warm workers) in %.2f s\n", (int)jobs.size() - num_failed, (int)jobs.size(),
+           num_frames, num_warm, elapsed_s);
+
+    delete runner;
+    RenderContext::terminate();
+    return (num_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Checks that every shard of a sharded run finished and that all of their images are present, then
+// encodes the video (when the output format is 'mp4')
+int mergeShards(AppData *app_ptr)
+{
+    std::string dir = app_ptr->merge_dir;
+    if (dir[dir.length() - 1] != '/') dir += "/";
+
+    std::vector<std::string> paths;
+    if (!listShardManifests(dir, &paths) || paths.empty())
+    {
+        fprintf(stderr, "Error: no shard manifests found in '%s'\n", dir.c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::vector<ShardManifest> manifests(paths.size());
+    std::vector<ShardFrame> frames;
+    int errors = 0;
+    size_t i, j;
+    for (i = 0; i < paths.size(); i++)
+    {
+        if (!readShardManifest(paths[i], &manifests[i]))
+        {
+            fprintf(stderr, "Error: could not read shard manifest '%s'\n", paths[i].c_str());
+            return EXIT_FAILURE;
+        }
+        const ShardManifest& m = manifests[i];
+        if (m.shard_count != manifests[0].shard_count || m.frame_start != manifests[0].frame_start || m.frame_end != manifests[0].frame_end ||
+            m.frame_stride != manifests[0].frame_stride || m.range_frames != manifests[0].range_frames)
+        {
+            fprintf(stderr, "Error: '%s' is from a different run than '%s'\n", paths[i].c_str(), paths[0].c_str());
+            return EXIT_FAILURE;
+        }
+        if (!m.complete)
+        {
+            fprintf(stderr, "Shard %d/%d did not finish\n", m.shard_index, m.shard_count);
+            errors++;
+        }
+        frames.insert(frames.end(), m.frames.begin(), m.frames.end());
+    }
+
+    // Every shard must be present (manifest names are unique per shard)
+    int shard_count = manifests[0].shard_count;
+    if ((int)manifests.size() != shard_count)
+    {
+        std::vector<bool> found(shard_count, false);
+        for (i = 0; i < manifests.size(); i++) found[manifests[i].shard_index] = true;
+        for (j = 0; j < found.size(); j++)
+        {
+            if (!found[j])
+            {
+                fprintf(stderr, "Shard %d/%d is missing\n", (int)j, shard_count);
+                errors++;
+            }
+        }
+    }
+
+    // Every frame must exist with the size it was written with (listed in frame order for the video),
+    // and be written by one shard only
+    std::sort(frames.begin(), frames.end(), [](const ShardFrame& a, const ShardFrame& b) { return a.number < b.number; });
+    for (i = 1; i < frames.size(); i++)
+    {
+        if (frames[i].number == frames[i - 1].number)
+        {
+            fprintf(stderr, "Frame %06d: written by more than one shard\n", frames[i].number);
+            errors++;
+        }
+    }
+    std::vector<std::string> images;
+    for (i = 0; i < frames.size(); i++)
+    {
+        std::string path = dir + frames[i].file;
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0 || info.st_size != frames[i].size)
+        {
+            fprintf(stderr, "Frame %06d: '%s' is missing or has changed\n", frames[i].number, path.c_str());
+            errors++;
+        }
+        images.push_back(path);
+    }
+    if ((int64_t)frames.size() != manifests[0].range_frames)
+    {
+        fprintf(stderr, "Shards hold %d frames, but the range has %d\n", (int)frames.size(), (int)manifests[0].range_frames);
+        errors++;
+    }
+    if (errors > 0)
+    {
+        fprintf(stderr, "Merge failed: %d problem(s) found\n", errors);
+        return EXIT_FAILURE;
+    }
+    printf("Verified %d frames from %d shards\n", (int)frames.size(), shard_count);
+
+    if (app_ptr->out_format == "mp4" && !frames.empty())
+    {
+        if (!convertImageSequenceToVideo(dir, app_ptr->video_framerate, images))
+        {
+            return EXIT_FAILURE;
+        }
+        for (i = 0; i < paths.size(); i++)
+        {
+            remove(paths[i].c_str());
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+bool convertImageSequenceToVideo(std::string image_dir, int image_framerate, const std::vector<std::string>& images)
 {
+    // Frame numbers may start anywhere and have gaps, so ffmpeg reads the exact images (in order) from
+    // a concat demuxer list, with paths relative to the list's directory
+    if (image_dir.empty() || image_dir[image_dir.length() - 1] != '/') image_dir += "/";
+    std::string list_path = image_dir + "equirect_frames.txt";
+    FILE *list = fopen(list_path.c_str(), "w");
+    if (list == NULL)
+    {
+        fprintf(stderr, "Warning: could not write '%s'. Saved as image sequence instead.\n", list_path.c_str());
+        return false;
+    }
+    fprintf(list, "ffconcat version 1.0\n");
+    size_t i, j;
+    for (i = 0; i < images.size(); i++)
+    {
+        size_t slash = images[i].find_last_of('/');
+        std::string name = (slash != std::string::npos) ? images[i].substr(slash + 1) : images[i];
+        // A quote in a name is written as '\''
+        std::string quoted = "";
+        for (j = 0; j < name.length(); j++)
+        {
+            quoted += (name[j] == '\'') ? std::string("'\\''") : std::string(1, name[j]);
+        }
+        fprintf(list, "file '%s'\n", quoted.c_str());
+    }
+    fclose(list);
+
     char *ffmpeg_cmd = new char[512];
     int framerate_mult = (24 % image_framerate == 0) ? (24 / image_framerate) : (24 / image_framerate) + 1;
     int video_framerate = (image_framerate < 24) ? framerate_mult * image_framerate : image_framerate;
@@ -209,25 +944,23 @@ void convertImageSequenceToVideo(std::string image_dir, std::string img_format,
 #else
     const char *o_null = "/dev/null";
 #endif
-    snprintf(ffmpeg_cmd, 512, "ffmpeg -y -start_number 0 -r %d -i \"%sequirect_%%06d.%s\" -r %d -c:v libx264 -an -pix_fmt yuv420p \"%sequirect.mp4\" > %s 2>&1", image_framerate, image_dir.c_str(), img_format.c_str(), video_framerate, image_dir.c_str(), o_null);
+    snprintf(ffmpeg_cmd, 512, "ffmpeg -y -r %d -f concat -safe 0 -i \"%s\" -r %d -c:v libx264 -an -pix_fmt yuv420p \"%sequirect.mp4\" > %s 2>&1", image_framerate, list_path.c_str(), video_framerate, image_dir.c_str(), o_null);
     
     int err = system(ffmpeg_cmd);
+    remove(list_path.c_str());
     if (err != 0)
     {
         fprintf(stderr, "Warning: ffmpeg conversion to mp4 not successful. Saved as image sequence instead.\n");
     }
     else
     {
-        char *img_filename = new char[256];
-        int i = 0;
-        do
+        for (i = 0; i < images.size(); i++)
         {
-            snprintf(img_filename, 256, "%sequirect_%06d.%s", image_dir.c_str(), i, img_format.c_str());
-            i++;
-        } while (remove(img_filename) == 0);
-        
-        delete[] img_filename;
+            remove(images[i].c_str());
+        }
     }
     delete[] ffmpeg_cmd;
+
+    return (err == 0);
 }
 
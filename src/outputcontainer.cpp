@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include "outputcontainer.h"
+
+static void putU16(std::vector<uint8_t>& bytes, uint16_t value);
+static void putU64(std::vector<uint8_t>& bytes, uint64_t value);
+
+// Container format named by an output path's extension ('.tar' or '.pack')
+ContainerFormat OutputContainer::formatFromPath(std::string path)
+{
+    size_t dot = path.find_last_of('.');
+    std::string ext = (dot != std::string::npos) ? path.substr(dot + 1) : "";
+    if (ext == "tar") return CONTAINER_TAR;
+    if (ext == "pack") return CONTAINER_PACK;
+    return CONTAINER_NONE;
+}
+
+OutputContainer::OutputContainer(ContainerFormat format)
+{
+    _format = format;
+    _size = 0;
+}
+
+OutputContainer::~OutputContainer()
+{
+}
+
+// Public
+// Fills `bytes` with what starts the file, returning its offset (0)
+int64_t OutputContainer::begin(std::vector<uint8_t>& bytes)
+{
+    bytes.clear();
+    if (_format == CONTAINER_PACK)
+    {
+        bytes.insert(bytes.end(), (const uint8_t*)"C2EPACK1", (const uint8_t*)"C2EPACK1" + 8);
+    }
+    _size = bytes.size();
+    return 0;
+}
+
+// Fills `record` with a member's header and data, returning the offset it goes at
+int64_t OutputContainer::append(std::string name, const std::vector<uint8_t>& data, std::vector<uint8_t>& record)
+{
+    record.clear();
+    if (_format == CONTAINER_TAR)
+    {
+        // ustar header (fields are NUL terminated octal); the padding after the data is left to the
+        // next record's offset, as the gap reads back as zeros
+        record.resize(512, 0);
+        char *header = (char*)record.data();
+        snprintf(header, 100, "%s", name.c_str());
+        snprintf(header + 100, 8, "%07o", 0644);
+        snprintf(header + 108, 8, "%07o", 0);
+        snprintf(header + 116, 8, "%07o", 0);
+        snprintf(header + 124, 12, "%011llo", (unsigned long long)data.size());
+        snprintf(header + 136, 12, "%011llo", (unsigned long long)time(NULL));
+        header[156] = '0';
+        memcpy(header + 257, "ustar\0" "00", 8);
+        memset(header + 148, ' ', 8);
+        unsigned int checksum = 0;
+        int i;
+        for (i = 0; i < 512; i++)
+        {
+            checksum += (uint8_t)header[i];
+        }
+        snprintf(header + 148, 8, "%06o", checksum);
+    }
+    else
+    {
+        putU64(record, data.size());
+    }
+    record.insert(record.end(), data.begin(), data.end());
+
+    int64_t offset = _size;
+    Entry entry;
+    entry.name = name;
+    entry.offset = offset + (int64_t)(record.size() - data.size());
+    entry.length = data.size();
+    _entries.push_back(entry);
+    _size = offset + record.size();
+    if (_format == CONTAINER_TAR) _size = (_size + 511) & ~(int64_t)511;
+
+    return offset;
+}
+
+// Fills `bytes` with what ends the file (the index, or tar's end-of-archive blocks), returning its offset
+int64_t OutputContainer::finish(std::vector<uint8_t>& bytes)
+{
+    bytes.clear();
+    if (_format == CONTAINER_TAR)
+    {
+        bytes.resize(1024, 0);
+    }
+    else
+    {
+        size_t i;
+        for (i = 0; i < _entries.size(); i++)
+        {
+            putU64(bytes, _entries[i].offset);
+            putU64(bytes, _entries[i].length);
+            putU16(bytes, (uint16_t)_entries[i].name.length());
+            bytes.insert(bytes.end(), _entries[i].name.begin(), _entries[i].name.end());
+        }
+        putU64(bytes, _size);
+        putU64(bytes, _entries.size());
+        bytes.insert(bytes.end(), (const uint8_t*)"C2EINDEX", (const uint8_t*)"C2EINDEX" + 8);
+    }
+
+    int64_t offset = _size;
+    _size += bytes.size();
+    return offset;
+}
+
+size_t OutputContainer::count()
+{
+    return _entries.size();
+}
+
+static void putU16(std::vector<uint8_t>& bytes, uint16_t value)
+{
+    bytes.push_back(value & 0xFF);
+    bytes.push_back(value >> 8);
+}
+
+static void putU64(std::vector<uint8_t>& bytes, uint64_t value)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+        bytes.push_back((value >> (8 * i)) & 0xFF);
+    }
+}
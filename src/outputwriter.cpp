@@ -0,0 +1,453 @@
+#include <chrono>
+#include <set>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "outputwriter.h"
+
+OutputWriter::OutputWriter()
+{
+    _io = NULL;
+    _budget = 0;
+    _bytes_queued = 0;
+    _sync_batch = 0;
+    _submitted = 0;
+    _finished = 0;
+    _waiting = false;
+    _failed_path = "";
+    _container = NULL;
+    _container_fd = -1;
+    _stream_fd = -1;
+    _stop = false;
+    _stats = WriterStats();
+}
+
+// Writes whatever is still queued (and finishes the container) before returning
+OutputWriter::~OutputWriter()
+{
+    if (_container != NULL)
+    {
+        finishContainer();
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _work_cv.notify_all();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    delete _io;
+}
+
+// Public
+// Starts the writer with the given AsyncIO backend ('auto', 'uring' or 'threads'). A budget of 0
+// makes each write wait until the file is in place; a sync batch of 0 leaves flushing to the OS.
+// Returns false if the backend is not available
+bool OutputWriter::start(std::string io_backend, int num_threads, int64_t budget_bytes, int sync_batch)
+{
+    _io = AsyncIO::create(io_backend, num_threads);
+    if (_io == NULL)
+    {
+        return false;
+    }
+    _budget = budget_bytes;
+    _sync_batch = sync_batch;
+    _thread = std::thread(&OutputWriter::run, this);
+    return true;
+}
+
+// Makes subsequent writes append to a container (its format chosen by the extension of `path`)
+// instead of writing files. Call before the first write
+bool OutputWriter::openContainer(std::string path)
+{
+    ContainerFormat format = OutputContainer::formatFromPath(path);
+    if (format == CONTAINER_NONE)
+    {
+        return false;
+    }
+    char tmp_suffix[32];
+    snprintf(tmp_suffix, 32, ".%d.tmp", (int)getpid());
+    _container_path = path;
+    _container_tmp_path = path + tmp_suffix;
+    _container_fd = open(_container_tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_container_fd < 0)
+    {
+        return false;
+    }
+    _container = new OutputContainer(format);
+    std::vector<uint8_t> bytes;
+    int64_t offset = _container->begin(bytes);
+    return writeAll(_container_fd, bytes, offset);
+}
+
+// Waits for all writes, then ends the container and renames it into place
+bool OutputWriter::finishContainer()
+{
+    if (_container == NULL)
+    {
+        return true;
+    }
+    flush();
+
+    std::vector<uint8_t> bytes;
+    int64_t offset = _container->finish(bytes);
+    bool ok = writeAll(_container_fd, bytes, offset) && getFailedPath().empty();
+    if (ok && _sync_batch > 0) ok = (fdatasync(_container_fd) == 0);
+    ok = (close(_container_fd) == 0) && ok;
+    if (!ok || rename(_container_tmp_path.c_str(), _container_path.c_str()) != 0)
+    {
+        remove(_container_tmp_path.c_str());
+        ok = false;
+    }
+    if (ok && _sync_batch > 0)
+    {
+        syncDirectories(std::vector<std::string>(1, _container_path));
+    }
+    delete _container;
+    _container = NULL;
+    _container_fd = -1;
+
+    return ok;
+}
+
+// Makes subsequent writes go to the end of the stream `fd` (which stays open), after `header`. Call
+// before the first write
+bool OutputWriter::openStream(int fd, const std::vector<uint8_t>& header)
+{
+    // A pipe is not synced, so there is nothing to batch
+    _stream_fd = fd;
+    _sync_batch = 0;
+    return writeStream(header);
+}
+
+// Queues `data` to be written to `path` (a member named after the file name, when writing a
+// container), swapping it for a recycled buffer. Returns the write's sequence number (writes
+// finish in order, see getFinishedCount)
+int64_t OutputWriter::write(std::string path, std::vector<uint8_t>& data)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    int64_t size = (int64_t)data.size();
+    if (_bytes_queued > 0 && _bytes_queued + size > _budget)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        _waiting = true;
+        _work_cv.notify_all();
+        while (_bytes_queued > 0 && _bytes_queued + size > _budget)
+        {
+            _done_cv.wait(lock);
+        }
+        _waiting = false;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        _stats.stalls++;
+        _stats.stall_ms += elapsed.count();
+    }
+
+    Job *job = new Job();
+    job->offset = 0;
+    job->ok = true;
+    if (_container != NULL)
+    {
+        // The member's header and data are copied into one record at its place in the container
+        size_t slash = path.find_last_of('/');
+        std::string name = (slash != std::string::npos) ? path.substr(slash + 1) : path;
+        job->path = _container_path + ":" + name;
+        if (!_pool.empty())
+        {
+            job->data.swap(_pool.back());
+            _pool.pop_back();
+        }
+        job->file_offset = _container->append(name, data, job->data);
+        job->fd = _container_fd;
+        size = (int64_t)job->data.size();
+    }
+    else if (_stream_fd >= 0)
+    {
+        job->path = path;
+        job->data.swap(data);
+        job->fd = _stream_fd;
+        job->file_offset = 0;
+        if (!_pool.empty())
+        {
+            data.swap(_pool.back());
+            _pool.pop_back();
+        }
+    }
+    else
+    {
+        char tmp_suffix[32];
+        snprintf(tmp_suffix, 32, ".%d.tmp", (int)getpid());
+        job->path = path;
+        job->tmp_path = path + tmp_suffix;
+        job->data.swap(data);
+        job->fd = -1;
+        job->file_offset = 0;
+        if (!_pool.empty())
+        {
+            data.swap(_pool.back());
+            _pool.pop_back();
+        }
+    }
+    _queue.push_back(job);
+    _bytes_queued += size;
+    int64_t sequence = _submitted++;
+    _work_cv.notify_all();
+
+    if (_budget == 0)
+    {
+        _waiting = true;
+        while (_finished < _submitted)
+        {
+            _done_cv.wait(lock);
+        }
+        _waiting = false;
+    }
+
+    return sequence;
+}
+
+// Waits until every queued file is in place (and synced, in durable mode)
+void OutputWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _waiting = true;
+    _work_cv.notify_all();
+    while (_finished < _submitted)
+    {
+        _done_cv.wait(lock);
+    }
+    _waiting = false;
+}
+
+// Number of writes finished (successfully or not): those with a lower sequence number
+int64_t OutputWriter::getFinishedCount()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _finished;
+}
+
+// First file that could not be written (empty if none)
+std::string OutputWriter::getFailedPath()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _failed_path;
+}
+
+WriterStats OutputWriter::getStats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+const char* OutputWriter::getBackendName()
+{
+    if (_stream_fd >= 0) return "stream";
+    return (_io != NULL) ? _io->name() : "none";
+}
+
+// Private
+void OutputWriter::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        // Durable mode waits for a full sync batch, unless the caller is waiting on the writer
+        while (_queue.empty() || (_sync_batch > 0 && (int)_queue.size() < _sync_batch && !_waiting && !_stop))
+        {
+            if (_stop && _queue.empty())
+            {
+                return;
+            }
+            _work_cv.wait(lock);
+        }
+
+        std::vector<Job*> batch;
+        while (!_queue.empty() && (_sync_batch == 0 || (int)batch.size() < _sync_batch))
+        {
+            batch.push_back(_queue.front());
+            _queue.pop_front();
+        }
+
+        lock.unlock();
+        writeBatch(batch);
+        lock.lock();
+
+        size_t i;
+        for (i = 0; i < batch.size(); i++)
+        {
+            Job *job = batch[i];
+            _bytes_queued -= (int64_t)job->data.size();
+            if (job->ok)
+            {
+                _stats.files++;
+                _stats.bytes += (int64_t)job->data.size();
+            }
+            else if (_failed_path.empty())
+            {
+                _failed_path = job->path;
+            }
+            _pool.push_back(std::vector<uint8_t>());
+            _pool.back().swap(job->data);
+            delete job;
+        }
+        if (_sync_batch > 0) _stats.sync_batches++;
+        _finished += (int64_t)batch.size();
+        _done_cv.notify_all();
+    }
+}
+
+// Writes each job's data to its temporary file (or place in the container), syncs them (in durable
+// mode), and renames them into place
+void OutputWriter::writeBatch(std::vector<Job*>& batch)
+{
+    std::vector<IORequest> requests;
+    size_t i;
+
+    // A pipe has no offsets, so a stream is written in order (a consumer that is not keeping up
+    // holds the writer back, not the conversion)
+    if (_stream_fd >= 0)
+    {
+        for (i = 0; i < batch.size(); i++)
+        {
+            batch[i]->ok = writeStream(batch[i]->data);
+        }
+        return;
+    }
+
+    for (i = 0; i < batch.size(); i++)
+    {
+        Job *job = batch[i];
+        if (_container == NULL) job->fd = open(job->tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        job->ok = (job->fd >= 0);
+        if (job->ok && !job->data.empty())
+        {
+            IORequest request = {job->fd, job->data.data(), job->data.size(), job->file_offset, IO_WRITE, job};
+            requests.push_back(request);
+        }
+    }
+    completeAll(requests, true);
+
+    if (_sync_batch > 0)
+    {
+        for (i = 0; i < batch.size(); i++)
+        {
+            if (!batch[i]->ok) continue;
+            IORequest request = {batch[i]->fd, NULL, 0, 0, IO_FSYNC, batch[i]};
+            requests.push_back(request);
+            if (_container != NULL) break; // one sync covers the whole container
+        }
+        completeAll(requests, false);
+    }
+    if (_container != NULL)
+    {
+        return;
+    }
+
+    std::vector<std::string> renamed;
+    for (i = 0; i < batch.size(); i++)
+    {
+        Job *job = batch[i];
+        if (job->fd >= 0 && close(job->fd) != 0) job->ok = false;
+        job->fd = -1;
+        if (!job->ok || rename(job->tmp_path.c_str(), job->path.c_str()) != 0)
+        {
+            job->ok = false;
+            remove(job->tmp_path.c_str());
+            continue;
+        }
+        renamed.push_back(job->path);
+    }
+
+    // Make the renames durable too
+    if (_sync_batch > 0)
+    {
+        syncDirectories(renamed);
+    }
+}
+
+// Submits the requests and waits for all of them, resubmitting the remainder of short writes
+void OutputWriter::completeAll(std::vector<IORequest>& requests, bool writes)
+{
+    std::vector<IOCompletion> completions;
+    while (!requests.empty())
+    {
+        size_t count = requests.size();
+        _io->submit(requests);
+        requests.clear();
+        _io->wait(completions, count);
+
+        size_t i;
+        for (i = 0; i < completions.size(); i++)
+        {
+            Job *job = (Job*)completions[i].user;
+            if (completions[i].result < 0 || (writes && completions[i].result == 0))
+            {
+                job->ok = false;
+                continue;
+            }
+            if (!writes) continue;
+            job->offset += completions[i].result;
+            if (job->offset < job->data.size())
+            {
+                IORequest request = {job->fd, job->data.data() + job->offset, job->data.size() - job->offset, job->file_offset + (int64_t)job->offset, IO_WRITE, job};
+                requests.push_back(request);
+            }
+        }
+        completions.clear();
+    }
+}
+
+void OutputWriter::syncDirectories(const std::vector<std::string>& paths)
+{
+    std::set<std::string> directories;
+    size_t i;
+    for (i = 0; i < paths.size(); i++)
+    {
+        size_t slash = paths[i].find_last_of('/');
+        directories.insert((slash != std::string::npos) ? paths[i].substr(0, slash + 1) : ".");
+    }
+    std::set<std::string>::iterator it;
+    for (it = directories.begin(); it != directories.end(); it++)
+    {
+        int fd = open(it->c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0)
+        {
+            fsync(fd);
+            close(fd);
+        }
+    }
+}
+
+// Synchronous positioned write of a container's start or end
+bool OutputWriter::writeAll(int fd, const std::vector<uint8_t>& bytes, int64_t offset)
+{
+    size_t written = 0;
+    while (written < bytes.size())
+    {
+        ssize_t count = pwrite(fd, bytes.data() + written, bytes.size() - written, offset + written);
+        if (count <= 0)
+        {
+            return false;
+        }
+        written += count;
+    }
+    return true;
+}
+
+bool OutputWriter::writeStream(const std::vector<uint8_t>& bytes)
+{
+    size_t written = 0;
+    while (written < bytes.size())
+    {
+        ssize_t count = ::write(_stream_fd, bytes.data() + written, bytes.size() - written);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0)
+        {
+            return false;
+        }
+        written += count;
+    }
+    return true;
+}
@@ -0,0 +1,317 @@
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "prefetcher.h"
+
+Prefetcher::Prefetcher()
+{
+    _io = NULL;
+    _budget = 0;
+    _bytes_held = 0;
+    _in_flight = 0;
+    _stop = false;
+    _stats = PrefetchStats();
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _work_cv.notify_all();
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+    delete _io;
+}
+
+// Public
+// Starts reading ahead with the given AsyncIO backend ('auto', 'uring' or 'threads', where
+// `num_threads` sizes the thread pool). Returns false if the backend is not available
+bool Prefetcher::start(std::string io_backend, int num_threads, int64_t budget_bytes)
+{
+    _io = AsyncIO::create(io_backend, num_threads);
+    if (_io == NULL)
+    {
+        return false;
+    }
+    _budget = budget_bytes;
+    _thread = std::thread(&Prefetcher::run, this);
+    return true;
+}
+
+// Queues a file to be read (`size` is its expected size, for the byte budget)
+void Prefetcher::request(std::string path, int64_t size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_io == NULL || _items.count(path) > 0)
+    {
+        return;
+    }
+
+    Item& item = _items[path];
+    item.size = size;
+    item.state = QUEUED;
+    item.advised = false;
+    item.urgent = false;
+    item.ok = false;
+    item.fd = -1;
+    item.offset = 0;
+    _queue.push_back(path);
+    _work_cv.notify_one();
+}
+
+// Moves a requested file's contents into `data`, waiting if it is still being read. Returns false
+// if the file was not requested (or could not be read), in which case the caller reads it itself
+bool Prefetcher::take(std::string path, std::vector<uint8_t>& data)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::map<std::string, Item>::iterator it = _items.find(path);
+    if (it == _items.end())
+    {
+        _stats.misses++;
+        return false;
+    }
+
+    if (it->second.state != READY)
+    {
+        // Not started yet: jump the queue (and the budget), since the caller needs it now
+        if (it->second.state == QUEUED)
+        {
+            it->second.urgent = true;
+            std::deque<std::string>::iterator q;
+            for (q = _queue.begin(); q != _queue.end(); q++)
+            {
+                if (*q == path)
+                {
+                    _queue.erase(q);
+                    break;
+                }
+            }
+            _queue.push_front(path);
+            _work_cv.notify_all();
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        while (it->second.state != READY)
+        {
+            _ready_cv.wait(lock);
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        _stats.stalls++;
+        _stats.stall_ms += elapsed.count();
+    }
+    else
+    {
+        _stats.hits++;
+    }
+
+    // Hand over the buffer, and keep the caller's old one for later reads
+    bool ok = it->second.ok;
+    data.swap(it->second.data);
+    _pool.push_back(std::vector<uint8_t>());
+    _pool.back().swap(it->second.data);
+    _bytes_held -= it->second.size;
+    _items.erase(it);
+    _work_cv.notify_all();
+
+    return ok;
+}
+
+// Drops a requested file that is no longer needed (waiting for it if it is being read)
+void Prefetcher::discard(std::string path)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::map<std::string, Item>::iterator it = _items.find(path);
+    if (it == _items.end())
+    {
+        return;
+    }
+    while (it->second.state == READING)
+    {
+        _ready_cv.wait(lock);
+    }
+    if (it->second.state == QUEUED)
+    {
+        std::deque<std::string>::iterator q;
+        for (q = _queue.begin(); q != _queue.end(); q++)
+        {
+            if (*q == path)
+            {
+                _queue.erase(q);
+                break;
+            }
+        }
+    }
+    else
+    {
+        _pool.push_back(std::vector<uint8_t>());
+        _pool.back().swap(it->second.data);
+        _bytes_held -= it->second.size;
+    }
+    _items.erase(it);
+    _work_cv.notify_all();
+}
+
+PrefetchStats Prefetcher::getStats()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+const char* Prefetcher::getBackendName()
+{
+    return (_io != NULL) ? _io->name() : "none";
+}
+
+// Private
+void Prefetcher::run()
+{
+    std::vector<IORequest> batch;
+    std::vector<IOCompletion> completions;
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop || _in_flight > 0)
+    {
+        // Open every queued file that fits in the budget (anything fits when nothing is held)
+        while (!_stop && !_queue.empty())
+        {
+            std::string path = _queue.front();
+            Item& item = _items[path];
+            if (!item.urgent && _bytes_held > 0 && _bytes_held + item.size > _budget)
+            {
+                break;
+            }
+            _queue.pop_front();
+            item.state = READING;
+            _bytes_held += item.size;
+            std::vector<uint8_t> data;
+            if (!_pool.empty())
+            {
+                data.swap(_pool.back());
+                _pool.pop_back();
+            }
+
+            lock.unlock();
+            int fd = openFile(path, data);
+            lock.lock();
+
+            // `item` is still valid: only READY or QUEUED items are removed
+            item.fd = fd;
+            item.offset = 0;
+            item.data.swap(data);
+            if (fd < 0 || item.data.empty()) finishItem(item, fd >= 0);
+            else batch.push_back(readRequest(item));
+        }
+
+        // ... and submit their reads together (along with the remainder of short reads)
+        if (!batch.empty())
+        {
+            _in_flight += batch.size();
+            lock.unlock();
+            _io->submit(batch);
+            lock.lock();
+            batch.clear();
+        }
+
+        // Over budget: let the kernel start on the queued files in the meantime
+        std::string advise_path = "";
+        std::deque<std::string>::iterator q;
+        for (q = _queue.begin(); !_stop && q != _queue.end(); q++)
+        {
+            Item& queued = _items[*q];
+            if (!queued.advised)
+            {
+                queued.advised = true;
+                advise_path = *q;
+                break;
+            }
+        }
+        if (!advise_path.empty())
+        {
+            lock.unlock();
+            int fd = open(advise_path.c_str(), O_RDONLY);
+            if (fd >= 0)
+            {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                close(fd);
+            }
+            lock.lock();
+        }
+
+        if (_in_flight > 0)
+        {
+            lock.unlock();
+            _io->wait(completions, 1);
+            lock.lock();
+
+            size_t i;
+            for (i = 0; i < completions.size(); i++)
+            {
+                Item& item = *((Item*)completions[i].user);
+                _in_flight--;
+                if (completions[i].result <= 0)
+                {
+                    finishItem(item, false);
+                    continue;
+                }
+                item.offset += completions[i].result;
+                if (item.offset < item.data.size()) batch.push_back(readRequest(item));
+                else finishItem(item, true);
+            }
+            completions.clear();
+        }
+        else if (advise_path.empty())
+        {
+            _work_cv.wait(lock);
+        }
+    }
+}
+
+// Opens a file and sizes `data` to hold it, returning the descriptor (or -1)
+int Prefetcher::openFile(const std::string& path, std::vector<uint8_t>& data)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    data.resize(info.st_size);
+
+    return fd;
+}
+
+IORequest Prefetcher::readRequest(Item& item)
+{
+    IORequest request;
+    request.fd = item.fd;
+    request.buffer = item.data.data() + item.offset;
+    request.length = item.data.size() - item.offset;
+    request.offset = item.offset;
+    request.op = IO_READ;
+    request.user = &item;
+    return request;
+}
+
+void Prefetcher::finishItem(Item& item, bool ok)
+{
+    if (item.fd >= 0)
+    {
+        close(item.fd);
+        item.fd = -1;
+    }
+    item.ok = ok;
+    item.state = READY;
+    if (ok) _stats.bytes_read += (int64_t)item.data.size();
+    _ready_cv.notify_all();
+}
@@ -0,0 +1,91 @@
+#include "rendercache.h"
+
+RenderCache::RenderCache()
+{
+    _hits = 0;
+    _misses = 0;
+}
+
+RenderCache::~RenderCache()
+{
+    std::map<std::string,Program>::iterator program;
+    for (program = _programs.begin(); program != _programs.end(); program++)
+    {
+        glDeleteProgram(program->second.program);
+    }
+    std::map<int,Geometry>::iterator geometry;
+    for (geometry = _geometry.begin(); geometry != _geometry.end(); geometry++)
+    {
+        glDeleteVertexArrays(1, &geometry->second.vertex_array);
+        glDeleteBuffers(3, geometry->second.buffers);
+    }
+    std::map<std::string,GLuint>::iterator texture;
+    for (texture = _textures.begin(); texture != _textures.end(); texture++)
+    {
+        glDeleteTextures(1, &texture->second);
+    }
+}
+
+// Public
+// Each lookup counts as a hit or a miss (a miss is followed by creating the object and adding it)
+RenderCache::Program* RenderCache::findProgram(std::string key)
+{
+    std::map<std::string,Program>::iterator it = _programs.find(key);
+    if (it == _programs.end())
+    {
+        _misses++;
+        return NULL;
+    }
+    _hits++;
+    return &it->second;
+}
+
+RenderCache::Program* RenderCache::addProgram(std::string key, const Program& program)
+{
+    return &(_programs[key] = program);
+}
+
+RenderCache::Geometry* RenderCache::findGeometry(int mesh_density)
+{
+    std::map<int,Geometry>::iterator it = _geometry.find(mesh_density);
+    if (it == _geometry.end())
+    {
+        _misses++;
+        return NULL;
+    }
+    _hits++;
+    return &it->second;
+}
+
+RenderCache::Geometry* RenderCache::addGeometry(int mesh_density, const Geometry& geometry)
+{
+    return &(_geometry[mesh_density] = geometry);
+}
+
+// Returns 0 when no texture has been added for `key`
+GLuint RenderCache::findTexture(std::string key)
+{
+    std::map<std::string,GLuint>::iterator it = _textures.find(key);
+    if (it == _textures.end())
+    {
+        _misses++;
+        return 0;
+    }
+    _hits++;
+    return it->second;
+}
+
+void RenderCache::addTexture(std::string key, GLuint texture)
+{
+    _textures[key] = texture;
+}
+
+int64_t RenderCache::getHits()
+{
+    return _hits;
+}
+
+int64_t RenderCache::getMisses()
+{
+    return _misses;
+}
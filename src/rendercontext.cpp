@@ -0,0 +1,141 @@
+#include <cstdio>
+#include <mutex>
+#include "rendercontext.h"
+
+EGLDisplay RenderContext::_display = EGL_NO_DISPLAY;
+EGLConfig RenderContext::_config = NULL;
+bool RenderContext::_gl_loaded = false;
+
+// GL entry points are loaded once, by the first context made current
+static std::mutex gl_load_mutex;
+
+RenderContext::RenderContext()
+{
+    _context = EGL_NO_CONTEXT;
+    _surface = EGL_NO_SURFACE;
+}
+
+RenderContext::~RenderContext()
+{
+    std::map<std::pair<int,int>,EGLSurface>::iterator it;
+    for (it = _surfaces.begin(); it != _surfaces.end(); it++)
+    {
+        eglDestroySurface(_display, it->second);
+    }
+    if (_context != EGL_NO_CONTEXT) eglDestroyContext(_display, _context);
+}
+
+// Public
+// Opens the default EGL display (once per process, before any context is created)
+bool RenderContext::initialize()
+{
+    // Prepare for EGL initialization
+    int egl_version = gladLoaderLoadEGL(NULL);
+    if (!egl_version)
+    {
+        fprintf(stderr, "Error: could not pre-initialize GLAD EGL\n");
+        return false;
+    }
+
+    // Initialize EGL
+    _display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint egl_major, egl_minor;
+    eglInitialize(_display, &egl_major, &egl_minor);
+    egl_version = gladLoaderLoadEGL(_display);
+    if (!egl_version)
+    {
+        fprintf(stderr, "Error: could not initialize EGL display\n");
+        return false;
+    }
+
+    // Initialize GL attributes
+    EGLint num_configs;
+    static const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    eglChooseConfig(_display, config_attribs, &_config, 1, &num_configs);
+    return true;
+}
+
+void RenderContext::terminate()
+{
+    if (_gl_loaded) gladLoaderUnloadGL();
+    eglTerminate(_display);
+    gladLoaderUnloadEGL();
+}
+
+// Creates the OpenGL context (compute shaders require OpenGL 4.3)
+bool RenderContext::create(bool compute)
+{
+    // Bind API (per thread)
+    eglBindAPI(EGL_OPENGL_API);
+
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, compute ? 4 : 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+        EGL_NONE
+    };
+    _context = eglCreateContext(_display, _config, EGL_NO_CONTEXT, context_attribs);
+    return _context != EGL_NO_CONTEXT;
+}
+
+// Makes the context current on the calling thread, rendering to a pbuffer of the given size
+bool RenderContext::makeCurrent(int width, int height)
+{
+    std::pair<int,int> size(width, height);
+    std::map<std::pair<int,int>,EGLSurface>::iterator it = _surfaces.find(size);
+    if (it == _surfaces.end())
+    {
+        const EGLint pbuffer_attribs[] = {
+            EGL_WIDTH, width,
+            EGL_HEIGHT, height,
+            EGL_NONE
+        };
+        EGLSurface surface = eglCreatePbufferSurface(_display, _config, pbuffer_attribs);
+        if (surface == EGL_NO_SURFACE)
+        {
+            return false;
+        }
+        it = _surfaces.insert(std::make_pair(size, surface)).first;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+    if (!eglMakeCurrent(_display, it->second, it->second, _context))
+    {
+        return false;
+    }
+    _surface = it->second;
+
+    // Initialize GLAD (OpenGL Extenstions)
+    std::lock_guard<std::mutex> lock(gl_load_mutex);
+    if (!_gl_loaded)
+    {
+        if (!gladLoaderLoadGL())
+        {
+            fprintf(stderr, "Error: could not initialize GLAD OpenGL extensions\n");
+            return false;
+        }
+        _gl_loaded = true;
+    }
+    return true;
+}
+
+// Detaches the context from the calling thread
+void RenderContext::release()
+{
+    eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    _surface = EGL_NO_SURFACE;
+}
+
+void RenderContext::swapBuffers()
+{
+    eglSwapBuffers(_display, _surface);
+}
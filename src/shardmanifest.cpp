@@ -0,0 +1,132 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <dirent.h>
+#include "shardmanifest.h"
+
+// Manifests are small text files:
+//   cube2equirect-shard 1
+//   shard <index> <count>
+//   range <start> <end> <stride> <frames>
+//   frame <number> <file> <size>     (one per output image)
+//   end <number of frame lines>      (only present once the shard finished)
+
+std::string shardManifestName(int shard_index, int shard_count)
+{
+    char name[64];
+    snprintf(name, 64, "shard_%d_of_%d.manifest", shard_index, shard_count);
+    return name;
+}
+
+// Writes to a temporary file and renames it into place, so a partial manifest is never visible
+bool writeShardManifest(std::string output_dir, const ShardManifest& manifest)
+{
+    std::string path = output_dir + shardManifestName(manifest.shard_index, manifest.shard_count);
+    std::string tmp_path = path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    fprintf(fp, "cube2equirect-shard 1\n");
+    fprintf(fp, "shard %d %d\n", manifest.shard_index, manifest.shard_count);
+    fprintf(fp, "range %d %d %d %lld\n", manifest.frame_start, manifest.frame_end, manifest.frame_stride, (long long)manifest.range_frames);
+    size_t i;
+    for (i = 0; i < manifest.frames.size(); i++)
+    {
+        fprintf(fp, "frame %d %s %lld\n", manifest.frames[i].number, manifest.frames[i].file.c_str(), (long long)manifest.frames[i].size);
+    }
+    if (manifest.complete)
+    {
+        fprintf(fp, "end %d\n", (int)manifest.frames.size());
+    }
+
+    bool ok = (fflush(fp) == 0);
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool readShardManifest(std::string path, ShardManifest *manifest)
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    *manifest = ShardManifest();
+    manifest->shard_count = 0;
+    manifest->complete = false;
+
+    char line[1024];
+    bool ok = (fgets(line, 1024, fp) != NULL && strcmp(line, "cube2equirect-shard 1\n") == 0);
+    while (ok && fgets(line, 1024, fp) != NULL)
+    {
+        char file[512];
+        long long a, b;
+        int n0, n1, n2;
+        if (sscanf(line, "shard %d %d", &n0, &n1) == 2)
+        {
+            manifest->shard_index = n0;
+            manifest->shard_count = n1;
+        }
+        else if (sscanf(line, "range %d %d %d %lld", &n0, &n1, &n2, &a) == 4)
+        {
+            manifest->frame_start = n0;
+            manifest->frame_end = n1;
+            manifest->frame_stride = n2;
+            manifest->range_frames = a;
+        }
+        else if (sscanf(line, "frame %d %511s %lld", &n0, file, &b) == 3)
+        {
+            ShardFrame frame;
+            frame.number = n0;
+            frame.file = file;
+            frame.size = b;
+            manifest->frames.push_back(frame);
+        }
+        else if (sscanf(line, "end %d", &n0) == 1)
+        {
+            // A count mismatch means the file was edited or truncated
+            manifest->complete = (n0 == (int)manifest->frames.size());
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+    fclose(fp);
+
+    return ok && manifest->shard_index >= 0 && manifest->shard_index < manifest->shard_count;
+}
+
+// Finds all shard manifests in a directory, sorted by name
+bool listShardManifests(std::string dir, std::vector<std::string> *paths)
+{
+    DIR *dp = opendir(dir.c_str());
+    if (dp == NULL)
+    {
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL)
+    {
+        const char *name = entry->d_name;
+        size_t length = strlen(name);
+        if (strncmp(name, "shard_", 6) == 0 && length > 9 && strcmp(name + length - 9, ".manifest") == 0)
+        {
+            paths->push_back(dir + name);
+        }
+    }
+    closedir(dp);
+    std::sort(paths->begin(), paths->end());
+
+    return true;
+}
@@ -0,0 +1,326 @@
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <mutex>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+// Names of the rings this process created, for the exit and signal handlers to unlink (fixed size, so
+// the signal handler reads them without allocating)
+static const int MAX_OWNED_RINGS = 8;
+static char owned_names[MAX_OWNED_RINGS][256];
+static std::mutex owned_names_mutex;
+
+ShmRing::ShmRing()
+{
+    _fd = -1;
+    _base = NULL;
+    _size = 0;
+    _header = NULL;
+    _slots = NULL;
+    _owner = false;
+    _next = 0;
+}
+
+// The creator removes the ring's name (mappings that are still open stay valid)
+ShmRing::~ShmRing()
+{
+    if (_base != NULL) munmap(_base, _size);
+    if (_fd >= 0) ::close(_fd);
+    if (_owner)
+    {
+        shm_unlink(_name.c_str());
+        registerOwnedName(_name, false);
+    }
+}
+
+// Public
+// Creates (or replaces) the ring `name` (e.g. '/c2e-out'), as its producer
+bool ShmRing::create(std::string name, ShmRingFormat format, int width, int height, int slot_count)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t frame_bytes = (size_t)width * height * 4 * ((format == RING_FACES) ? 6 : 1);
+    size_t slot_size = (frame_bytes + page - 1) / page * page;
+    size_t data_offset = (sizeof(ShmRingHeader) + slot_count * sizeof(ShmRingSlot) + page - 1) / page * page;
+
+    // A stale ring of the same name is unlinked rather than truncated, so anything still mapping it is unaffected
+    _name = name;
+    shm_unlink(name.c_str());
+    _fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (_fd < 0)
+    {
+        return false;
+    }
+    _owner = true;
+    registerOwnedName(name, true);
+    _size = data_offset + slot_size * slot_count;
+    if (ftruncate(_fd, (off_t)_size) != 0)
+    {
+        return false;
+    }
+    void *base = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (base == MAP_FAILED)
+    {
+        return false;
+    }
+    _base = (uint8_t*)base;
+    _header = (ShmRingHeader*)_base;
+    _slots = (ShmRingSlot*)(_base + sizeof(ShmRingHeader));
+
+    _header->slot_count = (uint32_t)slot_count;
+    _header->format = (uint32_t)format;
+    _header->width = (uint32_t)width;
+    _header->height = (uint32_t)height;
+    _header->slot_size = slot_size;
+    _header->data_offset = data_offset;
+    _header->closed = 0;
+    _header->consumer_pid = 0;
+    _header->write_seq = 0;
+    _header->read_seq = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(_header->magic, "C2ERING1", 8);
+    return true;
+}
+
+// Attaches to an existing ring, as its consumer
+bool ShmRing::open(std::string name)
+{
+    _name = name;
+    _fd = shm_open(name.c_str(), O_RDWR, 0);
+    struct stat info;
+    if (_fd < 0 || fstat(_fd, &info) != 0 || (size_t)info.st_size < sizeof(ShmRingHeader))
+    {
+        return false;
+    }
+    _size = (size_t)info.st_size;
+    void *base = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (base == MAP_FAILED)
+    {
+        return false;
+    }
+    _base = (uint8_t*)base;
+    _header = (ShmRingHeader*)_base;
+    _slots = (ShmRingSlot*)(_base + sizeof(ShmRingHeader));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // The data must fit in what was mapped
+    uint64_t slot_count = _header->slot_count;
+    uint64_t frame_bytes = (uint64_t)_header->width * _header->height * 4 * ((_header->format == RING_FACES) ? 6 : 1);
+    if (memcmp(_header->magic, "C2ERING1", 8) != 0 || slot_count == 0 || _header->format > RING_IMAGE || _header->slot_size < frame_bytes ||
+        _header->data_offset < sizeof(ShmRingHeader) + slot_count * sizeof(ShmRingSlot) || _header->data_offset + slot_count * _header->slot_size > _size)
+    {
+        return false;
+    }
+    _next = __atomic_load_n(&_header->read_seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&_header->consumer_pid, (uint32_t)getpid(), __ATOMIC_RELEASE);
+    return true;
+}
+
+ShmRingFormat ShmRing::getFormat()
+{
+    return (ShmRingFormat)_header->format;
+}
+
+int ShmRing::getWidth()
+{
+    return (int)_header->width;
+}
+
+int ShmRing::getHeight()
+{
+    return (int)_header->height;
+}
+
+// Waits until the consumer has released the oldest slot if the ring is full, and returns the data of
+// the next slot to fill (NULL if the consumer has gone)
+uint8_t* ShmRing::acquireWrite()
+{
+    uint32_t write_seq = _header->write_seq;
+    uint32_t last_read_seq = __atomic_load_n(&_header->read_seq, __ATOMIC_ACQUIRE);
+    std::chrono::steady_clock::time_point last_release = std::chrono::steady_clock::now();
+    while (true)
+    {
+        uint32_t read_seq = __atomic_load_n(&_header->read_seq, __ATOMIC_ACQUIRE);
+        if (write_seq - read_seq < _header->slot_count) break;
+        if (read_seq != last_read_seq)
+        {
+            last_read_seq = read_seq;
+            last_release = std::chrono::steady_clock::now();
+        }
+        if (!isConsumerAlive(last_release))
+        {
+            return NULL;
+        }
+        futexWait(&_header->read_seq, read_seq);
+    }
+    return _base + _header->data_offset + (write_seq % _header->slot_count) * _header->slot_size;
+}
+
+// Publishes the slot filled after acquireWrite
+void ShmRing::publish(int64_t frame, int64_t timestamp_ns)
+{
+    uint32_t write_seq = _header->write_seq;
+    ShmRingSlot *slot = &_slots[write_seq % _header->slot_count];
+    slot->frame = frame;
+    slot->timestamp_ns = timestamp_ns;
+    __atomic_store_n(&_header->write_seq, write_seq + 1, __ATOMIC_RELEASE);
+    futexWake(&_header->write_seq);
+}
+
+// Ends the stream (the consumer still gets the frames already published)
+void ShmRing::close()
+{
+    __atomic_store_n(&_header->closed, 1, __ATOMIC_RELEASE);
+    futexWake(&_header->write_seq);
+}
+
+// Waits until the consumer has released every published frame. Returns false if the consumer went
+// away first
+bool ShmRing::drain()
+{
+    uint32_t write_seq = _header->write_seq;
+    uint32_t last_read_seq = __atomic_load_n(&_header->read_seq, __ATOMIC_ACQUIRE);
+    std::chrono::steady_clock::time_point last_release = std::chrono::steady_clock::now();
+    while (true)
+    {
+        uint32_t read_seq = __atomic_load_n(&_header->read_seq, __ATOMIC_ACQUIRE);
+        if (read_seq == write_seq) break;
+        if (read_seq != last_read_seq)
+        {
+            last_read_seq = read_seq;
+            last_release = std::chrono::steady_clock::now();
+        }
+        if (!isConsumerAlive(last_release))
+        {
+            return false;
+        }
+        futexWait(&_header->read_seq, read_seq);
+    }
+    return true;
+}
+
+// Waits for the next frame, returning its data in place (valid until release). Returns false once
+// the producer has closed the ring and every frame has been read
+bool ShmRing::acquireRead(const uint8_t **data, int64_t *frame, int64_t *timestamp_ns)
+{
+    while (true)
+    {
+        uint32_t write_seq = __atomic_load_n(&_header->write_seq, __ATOMIC_ACQUIRE);
+        if (write_seq != _next) break;
+        if (__atomic_load_n(&_header->closed, __ATOMIC_ACQUIRE))
+        {
+            // A frame may have been published just before closing
+            if (__atomic_load_n(&_header->write_seq, __ATOMIC_ACQUIRE) != _next) continue;
+            return false;
+        }
+        futexWait(&_header->write_seq, write_seq);
+    }
+    ShmRingSlot *slot = &_slots[_next % _header->slot_count];
+    *data = _base + _header->data_offset + (_next % _header->slot_count) * _header->slot_size;
+    *frame = slot->frame;
+    *timestamp_ns = slot->timestamp_ns;
+    _next++;
+    return true;
+}
+
+// Whether a frame after the last one read has already been published
+bool ShmRing::isFrameWaiting()
+{
+    return __atomic_load_n(&_header->write_seq, __ATOMIC_ACQUIRE) != _next;
+}
+
+// Hands the slot from the last acquireRead back to the producer
+void ShmRing::release()
+{
+    __atomic_store_n(&_header->read_seq, _next, __ATOMIC_RELEASE);
+    futexWake(&_header->read_seq);
+}
+
+// Private
+// Whether the producer should keep waiting on the consumer: its process still exists, and it has
+// released a frame (or, before it attached, the producer started waiting) within CONSUMER_TIMEOUT_MS
+bool ShmRing::isConsumerAlive(std::chrono::steady_clock::time_point last_release)
+{
+    pid_t pid = (pid_t)__atomic_load_n(&_header->consumer_pid, __ATOMIC_ACQUIRE);
+    if (pid != 0 && kill(pid, 0) != 0 && errno == ESRCH)
+    {
+        return false;
+    }
+    return std::chrono::steady_clock::now() - last_release < std::chrono::milliseconds((int)CONSUMER_TIMEOUT_MS);
+}
+
+// Sleeps while `*word` still equals `value` (shared futexes, since the words are in shared memory).
+// A short timeout covers a wake that was missed because the other side exited
+void ShmRing::futexWait(uint32_t *word, uint32_t value)
+{
+    struct timespec timeout = {0, 100000000};
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+void ShmRing::futexWake(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Adds (or removes) a ring name for unlinkOwnedNames. The exit and signal handlers are installed with
+// the first ring (signals the process already handles itself are left alone)
+void ShmRing::registerOwnedName(const std::string& name, bool owned)
+{
+    static bool handlers_installed = false;
+    std::lock_guard<std::mutex> lock(owned_names_mutex);
+    int i;
+    for (i = 0; i < MAX_OWNED_RINGS; i++)
+    {
+        if (owned && owned_names[i][0] == '\0' && name.length() < sizeof(owned_names[i]))
+        {
+            memcpy(owned_names[i], name.c_str(), name.length() + 1);
+            break;
+        }
+        if (!owned && name == owned_names[i])
+        {
+            owned_names[i][0] = '\0';
+            break;
+        }
+    }
+    if (owned && !handlers_installed)
+    {
+        handlers_installed = true;
+        atexit(unlinkOwnedNames);
+        int signals[3] = {SIGINT, SIGTERM, SIGHUP};
+        for (i = 0; i < 3; i++)
+        {
+            struct sigaction action;
+            if (sigaction(signals[i], NULL, &action) == 0 && action.sa_handler == SIG_DFL)
+            {
+                memset(&action, 0, sizeof(action));
+                action.sa_handler = unlinkOwnedNamesOnSignal;
+                sigemptyset(&action.sa_mask);
+                sigaction(signals[i], &action, NULL);
+            }
+        }
+    }
+}
+
+void ShmRing::unlinkOwnedNames()
+{
+    int i;
+    for (i = 0; i < MAX_OWNED_RINGS; i++)
+    {
+        if (owned_names[i][0] != '\0') shm_unlink(owned_names[i]);
+    }
+}
+
+// Unlinks the rings, then ends the process with the signal's default action
+void ShmRing::unlinkOwnedNamesOnSignal(int signal_number)
+{
+    unlinkOwnedNames();
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}